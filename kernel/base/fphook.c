@@ -7,6 +7,8 @@
 #include <symbol.h>
 #include <pgtable.h>
 #include <cache.h>
+#include <kpmalloc.h>
+#include <kplock.h>
 #include "hmem.h"
 
 // transit0
@@ -20,24 +22,35 @@ uint64_t __attribute__((section(".fp.transit0.text"))) __attribute__((__noinline
     while (*--vptr != ARM64_NOP) {
     };
     vptr--;
-    fp_hook_chain_t *hook_chain = local_container_of((uint64_t)vptr, fp_hook_chain_t, transit);
+    hook_transit_t *transit = local_container_of((uint64_t)vptr, hook_transit_t, insts);
+    fp_hook_chain_t *hook_chain = transit->chain;
+    uint32_t ridx = hook_readers_enter(&hook_chain->readers);
+    hook_chain_items_t *items = *(hook_chain_items_t *volatile *)&hook_chain->items;
+    uint64_t skip = 0;
+    int direct = (hook_chain->flags & HOOK_CHAIN_NO_REENTRY) && hook_transit_nested(transit);
+    if (!direct && items->filtered) skip = hook_items_caller_skip(items, (uint64_t)__builtin_return_address(0), &direct);
+    if (direct) {
+        uint64_t ret = ((transit0_func_t)hook_chain->hook.origin_fp)();
+        hook_readers_exit(&hook_chain->readers, ridx);
+        return ret;
+    }
+    if (hook_chain->flags & HOOK_CHAIN_COUNT_CALLS) hook_chain->calls++;
     hook_fargs0_t fargs;
     fargs.skip_origin = 0;
     fargs.chain = hook_chain;
-    for (int32_t i = 0; i < hook_chain->chain_items_max; i++) {
-        if (hook_chain->states[i] != CHAIN_ITEM_STATE_READY) continue;
-        hook_chain0_callback func = hook_chain->befores[i];
-        if (func) func(&fargs, hook_chain->udata[i]);
+    for (int32_t i = 0; i < items->num; i++) {
+        hook_chain0_callback func = items->items[i].before;
+        if (func && !(skip >> i & 1)) func(&fargs, items->items[i].udata);
     }
     if (!fargs.skip_origin) {
         transit0_func_t origin_func = (transit0_func_t)hook_chain->hook.origin_fp;
         fargs.ret = origin_func();
     }
-    for (int32_t i = hook_chain->chain_items_max - 1; i >= 0; i--) {
-        if (hook_chain->states[i] != CHAIN_ITEM_STATE_READY) continue;
-        hook_chain0_callback func = hook_chain->afters[i];
-        if (func) func(&fargs, hook_chain->udata[i]);
+    for (int32_t i = items->num - 1; i >= 0; i--) {
+        hook_chain0_callback func = items->items[i].after;
+        if (func && !(skip >> i & 1)) func(&fargs, items->items[i].udata);
     }
+    hook_readers_exit(&hook_chain->readers, ridx);
     return fargs.ret;
 }
 extern void _fp_transit0_end();
@@ -54,7 +67,19 @@ _fp_transit4(uint64_t arg0, uint64_t arg1, uint64_t arg2, uint64_t arg3)
     while (*--vptr != ARM64_NOP) {
     };
     vptr--;
-    fp_hook_chain_t *hook_chain = local_container_of((uint64_t)vptr, fp_hook_chain_t, transit);
+    hook_transit_t *transit = local_container_of((uint64_t)vptr, hook_transit_t, insts);
+    fp_hook_chain_t *hook_chain = transit->chain;
+    uint32_t ridx = hook_readers_enter(&hook_chain->readers);
+    hook_chain_items_t *items = *(hook_chain_items_t *volatile *)&hook_chain->items;
+    uint64_t skip = 0;
+    int direct = (hook_chain->flags & HOOK_CHAIN_NO_REENTRY) && hook_transit_nested(transit);
+    if (!direct && items->filtered) skip = hook_items_caller_skip(items, (uint64_t)__builtin_return_address(0), &direct);
+    if (direct) {
+        uint64_t ret = ((transit4_func_t)hook_chain->hook.origin_fp)(arg0, arg1, arg2, arg3);
+        hook_readers_exit(&hook_chain->readers, ridx);
+        return ret;
+    }
+    if (hook_chain->flags & HOOK_CHAIN_COUNT_CALLS) hook_chain->calls++;
     hook_fargs4_t fargs;
     fargs.skip_origin = 0;
     fargs.arg0 = arg0;
@@ -62,20 +87,19 @@ _fp_transit4(uint64_t arg0, uint64_t arg1, uint64_t arg2, uint64_t arg3)
     fargs.arg2 = arg2;
     fargs.arg3 = arg3;
     fargs.chain = hook_chain;
-    for (int32_t i = 0; i < hook_chain->chain_items_max; i++) {
-        if (hook_chain->states[i] != CHAIN_ITEM_STATE_READY) continue;
-        hook_chain4_callback func = hook_chain->befores[i];
-        if (func) func(&fargs, hook_chain->udata[i]);
+    for (int32_t i = 0; i < items->num; i++) {
+        hook_chain4_callback func = items->items[i].before;
+        if (func && !(skip >> i & 1)) func(&fargs, items->items[i].udata);
     }
     if (!fargs.skip_origin) {
         transit4_func_t origin_func = (transit4_func_t)hook_chain->hook.origin_fp;
         fargs.ret = origin_func(fargs.arg0, fargs.arg1, fargs.arg2, fargs.arg3);
     }
-    for (int32_t i = hook_chain->chain_items_max - 1; i >= 0; i--) {
-        if (hook_chain->states[i] != CHAIN_ITEM_STATE_READY) continue;
-        hook_chain4_callback func = hook_chain->afters[i];
-        if (func) func(&fargs, hook_chain->udata[i]);
+    for (int32_t i = items->num - 1; i >= 0; i--) {
+        hook_chain4_callback func = items->items[i].after;
+        if (func && !(skip >> i & 1)) func(&fargs, items->items[i].udata);
     }
+    hook_readers_exit(&hook_chain->readers, ridx);
     return fargs.ret;
 }
 
@@ -94,7 +118,19 @@ _fp_transit8(uint64_t arg0, uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_
     while (*--vptr != ARM64_NOP) {
     };
     vptr--;
-    fp_hook_chain_t *hook_chain = local_container_of((uint64_t)vptr, fp_hook_chain_t, transit);
+    hook_transit_t *transit = local_container_of((uint64_t)vptr, hook_transit_t, insts);
+    fp_hook_chain_t *hook_chain = transit->chain;
+    uint32_t ridx = hook_readers_enter(&hook_chain->readers);
+    hook_chain_items_t *items = *(hook_chain_items_t *volatile *)&hook_chain->items;
+    uint64_t skip = 0;
+    int direct = (hook_chain->flags & HOOK_CHAIN_NO_REENTRY) && hook_transit_nested(transit);
+    if (!direct && items->filtered) skip = hook_items_caller_skip(items, (uint64_t)__builtin_return_address(0), &direct);
+    if (direct) {
+        uint64_t ret = ((transit8_func_t)hook_chain->hook.origin_fp)(arg0, arg1, arg2, arg3, arg4, arg5, arg6, arg7);
+        hook_readers_exit(&hook_chain->readers, ridx);
+        return ret;
+    }
+    if (hook_chain->flags & HOOK_CHAIN_COUNT_CALLS) hook_chain->calls++;
     hook_fargs8_t fargs;
     fargs.skip_origin = 0;
     fargs.arg0 = arg0;
@@ -106,21 +142,20 @@ _fp_transit8(uint64_t arg0, uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_
     fargs.arg6 = arg6;
     fargs.arg7 = arg7;
     fargs.chain = hook_chain;
-    for (int32_t i = 0; i < hook_chain->chain_items_max; i++) {
-        if (hook_chain->states[i] != CHAIN_ITEM_STATE_READY) continue;
-        hook_chain8_callback func = hook_chain->befores[i];
-        if (func) func(&fargs, hook_chain->udata[i]);
+    for (int32_t i = 0; i < items->num; i++) {
+        hook_chain8_callback func = items->items[i].before;
+        if (func && !(skip >> i & 1)) func(&fargs, items->items[i].udata);
     }
     if (!fargs.skip_origin) {
         transit8_func_t origin_func = (transit8_func_t)hook_chain->hook.origin_fp;
         fargs.ret =
             origin_func(fargs.arg0, fargs.arg1, fargs.arg2, fargs.arg3, fargs.arg4, fargs.arg5, fargs.arg6, fargs.arg7);
     }
-    for (int32_t i = hook_chain->chain_items_max - 1; i >= 0; i--) {
-        if (hook_chain->states[i] != CHAIN_ITEM_STATE_READY) continue;
-        hook_chain8_callback func = hook_chain->afters[i];
-        if (func) func(&fargs, hook_chain->udata[i]);
+    for (int32_t i = items->num - 1; i >= 0; i--) {
+        hook_chain8_callback func = items->items[i].after;
+        if (func && !(skip >> i & 1)) func(&fargs, items->items[i].udata);
     }
+    hook_readers_exit(&hook_chain->readers, ridx);
     return fargs.ret;
 }
 
@@ -140,7 +175,19 @@ _fp_transit12(uint64_t arg0, uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64
     while (*--vptr != ARM64_NOP) {
     };
     vptr--;
-    fp_hook_chain_t *hook_chain = local_container_of((uint64_t)vptr, fp_hook_chain_t, transit);
+    hook_transit_t *transit = local_container_of((uint64_t)vptr, hook_transit_t, insts);
+    fp_hook_chain_t *hook_chain = transit->chain;
+    uint32_t ridx = hook_readers_enter(&hook_chain->readers);
+    hook_chain_items_t *items = *(hook_chain_items_t *volatile *)&hook_chain->items;
+    uint64_t skip = 0;
+    int direct = (hook_chain->flags & HOOK_CHAIN_NO_REENTRY) && hook_transit_nested(transit);
+    if (!direct && items->filtered) skip = hook_items_caller_skip(items, (uint64_t)__builtin_return_address(0), &direct);
+    if (direct) {
+        uint64_t ret = ((transit12_func_t)hook_chain->hook.origin_fp)(arg0, arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8, arg9, arg10, arg11);
+        hook_readers_exit(&hook_chain->readers, ridx);
+        return ret;
+    }
+    if (hook_chain->flags & HOOK_CHAIN_COUNT_CALLS) hook_chain->calls++;
     hook_fargs12_t fargs;
     fargs.skip_origin = 0;
     fargs.arg0 = arg0;
@@ -156,21 +203,20 @@ _fp_transit12(uint64_t arg0, uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64
     fargs.arg10 = arg10;
     fargs.arg11 = arg11;
     fargs.chain = hook_chain;
-    for (int32_t i = 0; i < hook_chain->chain_items_max; i++) {
-        if (hook_chain->states[i] != CHAIN_ITEM_STATE_READY) continue;
-        hook_chain12_callback func = hook_chain->befores[i];
-        if (func) func(&fargs, hook_chain->udata[i]);
+    for (int32_t i = 0; i < items->num; i++) {
+        hook_chain12_callback func = items->items[i].before;
+        if (func && !(skip >> i & 1)) func(&fargs, items->items[i].udata);
     }
     if (!fargs.skip_origin) {
         transit12_func_t origin_func = (transit12_func_t)hook_chain->hook.origin_fp;
         fargs.ret = origin_func(fargs.arg0, fargs.arg1, fargs.arg2, fargs.arg3, fargs.arg4, fargs.arg5, fargs.arg6,
                                 fargs.arg7, fargs.arg8, fargs.arg9, fargs.arg10, fargs.arg11);
     }
-    for (int32_t i = hook_chain->chain_items_max - 1; i >= 0; i--) {
-        if (hook_chain->states[i] != CHAIN_ITEM_STATE_READY) continue;
-        hook_chain12_callback func = hook_chain->afters[i];
-        if (func) func(&fargs, hook_chain->udata[i]);
+    for (int32_t i = items->num - 1; i >= 0; i--) {
+        hook_chain12_callback func = items->items[i].after;
+        if (func && !(skip >> i & 1)) func(&fargs, items->items[i].udata);
     }
+    hook_readers_exit(&hook_chain->readers, ridx);
     return fargs.ret;
 }
 
@@ -207,7 +253,7 @@ static hook_err_t hook_chain_prepare(uint32_t *transit, int32_t argno)
     int32_t transit_num = (transit_end - transit_start) / 4;
 
     // todo: assert
-    if (transit_num >= TRANSIT_INST_NUM) return -HOOK_TRANSIT_NO_MEM;
+    if (transit_num + 2 > TRANSIT_INST_NUM) return -HOOK_TRANSIT_NO_MEM;
 
     transit[0] = ARM64_BTI_JC;
     transit[1] = ARM64_NOP;
@@ -217,98 +263,238 @@ static hook_err_t hook_chain_prepare(uint32_t *transit, int32_t argno)
     return HOOK_NO_ERR;
 }
 
+#define fp_page(addr) ((addr) & ~((uintptr_t)page_size - 1))
+
+/**
+ * @brief Store vals into fp_addrs, olds gets the previous values if not null.
+ * Writable pages are stored directly, read-only pages are made writable once for all of their targets.
+ */
+static void fp_store(const uintptr_t *fp_addrs, void *const *vals, void **olds, int32_t num)
+{
+    for (int32_t i = 0; i < num; i++) {
+        uintptr_t page = fp_page(fp_addrs[i]);
+        int32_t done = 0;
+        for (int32_t k = 0; k < i && !done; k++) {
+            done = fp_page(fp_addrs[k]) == page;
+        }
+        if (done) continue;
+
+        uint64_t *entry = pgtable_entry_kernel(fp_addrs[i]);
+        uint64_t ori_prot = *entry;
+        int32_t rdonly = !!(ori_prot & PTE_RDONLY);
+        if (rdonly) modify_entry_kernel(fp_addrs[i], entry, (ori_prot | PTE_DBM) & ~PTE_RDONLY);
+        for (int32_t j = i; j < num; j++) {
+            if (fp_page(fp_addrs[j]) != page) continue;
+            if (olds) olds[j] = *(void **)fp_addrs[j];
+            *(void *volatile *)fp_addrs[j] = vals[j];
+        }
+        dsb(ish);
+        if (rdonly) modify_entry_kernel(fp_addrs[i], entry, ori_prot);
+    }
+}
+
 void fp_hook(uintptr_t fp_addr, void *replace, void **backup)
 {
-    uint64_t *entry = pgtable_entry_kernel(fp_addr);
-    uint64_t ori_prot = *entry;
-    modify_entry_kernel(fp_addr, entry, (ori_prot | PTE_DBM) & ~PTE_RDONLY);
-    flush_tlb_kernel_page(fp_addr);
-    *(uintptr_t *)backup = *(uintptr_t *)fp_addr;
-    *(uintptr_t *)fp_addr = (uintptr_t)replace;
-    dsb(ish);
-    modify_entry_kernel(fp_addr, entry, ori_prot);
+    fp_store(&fp_addr, &replace, backup, 1);
 }
 KP_EXPORT_SYMBOL(fp_hook);
 
+void fp_hook_batch(const uintptr_t *fp_addrs, void *const *replaces, void **backups, int32_t num)
+{
+    fp_store(fp_addrs, replaces, backups, num);
+}
+KP_EXPORT_SYMBOL(fp_hook_batch);
+
 void fp_unhook(uintptr_t fp_addr, void *backup)
 {
-    uint64_t *entry = pgtable_entry_kernel(fp_addr);
-    uint64_t ori_prot = *entry;
-    modify_entry_kernel(fp_addr, entry, (ori_prot | PTE_DBM) & ~PTE_RDONLY);
-    *(uintptr_t *)fp_addr = (uintptr_t)backup;
-    dsb(ish);
+    fp_store(&fp_addr, &backup, 0, 1);
     isb();
     flush_icache_all();
-    modify_entry_kernel(fp_addr, entry, ori_prot);
 }
 KP_EXPORT_SYMBOL(fp_unhook);
 
-hook_err_t fp_hook_wrap(uintptr_t fp_addr, int32_t argno, void *before, void *after, void *udata)
+static hook_err_t fp_wrap_chain_locked(uintptr_t fp_addr, int32_t argno, void *before, void *after, void *udata,
+                                       int32_t priority, uint32_t flags, const hook_caller_range_t *callers,
+                                       int32_t caller_num)
 {
     hook_err_t err = HOOK_NO_ERR;
-    if (is_bad_address((void *)fp_addr)) return -HOOK_BAD_ADDRESS;
     fp_hook_chain_t *chain = hook_get_mem_from_origin(fp_addr);
     if (!chain) {
         chain = (fp_hook_chain_t *)hook_mem_zalloc(fp_addr, FUNCTION_POINTER_CHAIN);
         if (!chain) return -HOOK_NO_MEM;
+        hook_transit_t *transit = (hook_transit_t *)hook_mem_class_zalloc(HOOK_MEM_TRANSIT);
+        if (!transit) {
+            hook_mem_free(chain);
+            return -HOOK_NO_MEM;
+        }
+        transit->chain = chain;
+        transit->stack = &hook_stack;
+        chain->transit = transit;
+        hook_chain_items_init(&chain->items);
         chain->hook.fp_addr = fp_addr;
-        chain->hook.replace_addr = (uint64_t)chain->transit;
-        err = hook_chain_prepare(chain->transit, argno);
-        if (err) return err;
+        chain->flags = flags;
+        chain->hook.replace_addr = (uint64_t)transit->insts;
+        err = hook_chain_prepare(transit->insts, argno);
+        if (err) {
+            hook_mem_free(transit);
+            hook_mem_free(chain);
+            return err;
+        }
         flush_icache_all();
         fp_hook(chain->hook.fp_addr, (void *)chain->hook.replace_addr, (void **)&chain->hook.origin_fp);
     }
 
-    for (int i = 0; i < FP_HOOK_CHAIN_NUM; i++) {
-        if ((before && chain->befores[i] == before) || (after && chain->afters[i] == after)) return -HOOK_DUPLICATED;
-
-        // todo: atomic or lock
-        if (chain->states[i] == CHAIN_ITEM_STATE_EMPTY) {
-            chain->states[i] = CHAIN_ITEM_STATE_BUSY;
-            dsb(ish);
-            chain->udata[i] = udata;
-            chain->befores[i] = before;
-            chain->afters[i] = after;
-            if (i + 1 > chain->chain_items_max) {
-                chain->chain_items_max = i + 1;
-            }
-            dsb(ish);
-            chain->states[i] = CHAIN_ITEM_STATE_READY;
-            logkv("Wrap func pointer add: %llx, %llx, %llx successed\n", chain->hook.fp_addr, before, after);
-            return HOOK_NO_ERR;
-        }
-    }
-    logkv("Wrap func pointer add: %llx, %llx, %llx failed\n", chain->hook.fp_addr, before, after);
-    return -HOOK_CHAIN_FULL;
+    chain->flags |= flags;
+    err = hook_chain_items_add(&chain->items, &chain->retired, &chain->readers, before, after, udata, priority,
+                               callers, caller_num);
+    logkv("Wrap func pointer add: %llx, %llx, %llx, priority: %d, callers: %d, err: %d\n", chain->hook.fp_addr, before,
+          after, priority, caller_num, err);
+    return err;
+}
+
+static hook_err_t fp_wrap_chain(uintptr_t fp_addr, int32_t argno, void *before, void *after, void *udata,
+                                int32_t priority, uint32_t flags, const hook_caller_range_t *callers,
+                                int32_t caller_num)
+{
+    if (is_bad_address((void *)fp_addr)) return -HOOK_BAD_ADDRESS;
+    hook_lock();
+    hook_err_t err =
+        fp_wrap_chain_locked(fp_addr, argno, before, after, udata, priority, flags, callers, caller_num);
+    hook_unlock();
+    return err;
+}
+
+hook_err_t fp_hook_wrap_flags(uintptr_t fp_addr, int32_t argno, void *before, void *after, void *udata,
+                              int32_t priority, uint32_t flags)
+{
+    return fp_wrap_chain(fp_addr, argno, before, after, udata, priority, flags, 0, 0);
+}
+KP_EXPORT_SYMBOL(fp_hook_wrap_flags);
+
+hook_err_t fp_hook_wrap_callers(uintptr_t fp_addr, int32_t argno, void *before, void *after, void *udata,
+                                int32_t priority, const hook_caller_range_t *callers, int32_t caller_num)
+{
+    return fp_wrap_chain(fp_addr, argno, before, after, udata, priority, 0, callers, caller_num);
+}
+KP_EXPORT_SYMBOL(fp_hook_wrap_callers);
+
+hook_err_t fp_hook_wrap_priority(uintptr_t fp_addr, int32_t argno, void *before, void *after, void *udata,
+                                 int32_t priority)
+{
+    return fp_hook_wrap_flags(fp_addr, argno, before, after, udata, priority, 0);
+}
+KP_EXPORT_SYMBOL(fp_hook_wrap_priority);
+
+hook_err_t fp_hook_wrap(uintptr_t fp_addr, int32_t argno, void *before, void *after, void *udata)
+{
+    return fp_hook_wrap_priority(fp_addr, argno, before, after, udata, HOOK_CHAIN_PRIORITY_DEFAULT);
 }
 KP_EXPORT_SYMBOL(fp_hook_wrap);
 
 void fp_hook_unwrap(uintptr_t fp_addr, void *before, void *after)
 {
     if (is_bad_address((void *)fp_addr)) return;
+    hook_lock();
     fp_hook_chain_t *chain = (fp_hook_chain_t *)hook_get_mem_from_origin(fp_addr);
-    if (!chain) return;
-    for (int i = 0; i < FP_HOOK_CHAIN_NUM; i++) {
-        if (chain->states[i] == CHAIN_ITEM_STATE_READY)
-            if ((before && chain->befores[i] == before) || (after && chain->afters[i] == after)) {
-                chain->states[i] = CHAIN_ITEM_STATE_BUSY;
-                dsb(ish);
-                chain->udata[i] = 0;
-                chain->befores[i] = 0;
-                chain->afters[i] = 0;
-                dsb(ish);
-                chain->states[i] = CHAIN_ITEM_STATE_EMPTY;
-                break;
-            }
-    }
+    if (!chain) goto out;
+    int32_t remain = hook_chain_items_remove(&chain->items, &chain->retired, &chain->readers, before, after);
     logkv("Wrap func pointer remove: %llx, %llx, %llx\n", chain->hook.fp_addr, before, after);
+    if (remain) goto out;
 
-    for (int i = 0; i < FP_HOOK_CHAIN_NUM; i++) {
-        if (chain->states[i] != CHAIN_ITEM_STATE_EMPTY) return;
-    }
     fp_unhook(chain->hook.fp_addr, (void *)chain->hook.origin_fp);
-    // todo: unsafe
-    hook_mem_free(chain);
+    // a caller can still run in the transit, freed by hook_reclaim
+    hook_chain_kill(chain);
     logkv("Unwrap func pointer: %llx, %llx, %llx\n", fp_addr, before, after);
+out:
+    hook_unlock();
+}
+KP_EXPORT_SYMBOL(fp_hook_unwrap);
+
+hook_err_t fp_hook_disarm(uintptr_t fp_addr)
+{
+    if (is_bad_address((void *)fp_addr)) return -HOOK_BAD_ADDRESS;
+    hook_err_t err = HOOK_NO_ERR;
+    hook_lock();
+    fp_hook_chain_t *chain = (fp_hook_chain_t *)hook_get_mem_from_origin(fp_addr);
+    if (!chain) {
+        err = -HOOK_NOT_FOUND;
+    } else if (*(uint64_t *)fp_addr == chain->hook.replace_addr) {
+        void *origin = (void *)chain->hook.origin_fp;
+        fp_store(&fp_addr, &origin, 0, 1);
+        logkv("Disarm func pointer: %llx\n", fp_addr);
+    }
+    hook_unlock();
+    return err;
+}
+KP_EXPORT_SYMBOL(fp_hook_disarm);
+
+hook_err_t fp_hook_arm(uintptr_t fp_addr)
+{
+    if (is_bad_address((void *)fp_addr)) return -HOOK_BAD_ADDRESS;
+    hook_err_t err = HOOK_NO_ERR;
+    hook_lock();
+    fp_hook_chain_t *chain = (fp_hook_chain_t *)hook_get_mem_from_origin(fp_addr);
+    if (!chain) {
+        err = -HOOK_NOT_FOUND;
+    } else if (*(uint64_t *)fp_addr != chain->hook.replace_addr) {
+        void *replace = (void *)chain->hook.replace_addr;
+        fp_store(&fp_addr, &replace, 0, 1);
+        logkv("Arm func pointer: %llx\n", fp_addr);
+    }
+    hook_unlock();
+    return err;
+}
+KP_EXPORT_SYMBOL(fp_hook_arm);
+
+fp_ops_clone_t *fp_ops_clone(void **slot, int32_t ops_size)
+{
+    if (is_bad_address(slot) || is_bad_address(*slot)) return 0;
+    if (ops_size <= 0 || ops_size & 7) return 0;
+    fp_ops_clone_t *clone = (fp_ops_clone_t *)kp_malloc(sizeof(fp_ops_clone_t) + ops_size);
+    if (!clone) return 0;
+    clone->slot = slot;
+    clone->origin_ops = *slot;
+    clone->ops_size = ops_size;
+    for (int32_t i = 0; i < ops_size / 8; i++) {
+        clone->ops[i] = ((uint64_t *)clone->origin_ops)[i];
+    }
+    dsb(ish);
+    *(void *volatile *)slot = clone->ops;
+    logkv("Clone ops: %llx, %llx -> %llx\n", slot, clone->origin_ops, clone->ops);
+    return clone;
+}
+KP_EXPORT_SYMBOL(fp_ops_clone);
+
+hook_err_t fp_ops_clone_wrap(fp_ops_clone_t *clone, int32_t offset, int32_t argno, void *before, void *after,
+                             void *udata)
+{
+    if (!clone || offset < 0 || offset + 8 > clone->ops_size || offset & 7) return -HOOK_BAD_ADDRESS;
+    uintptr_t fp_addr = (uintptr_t)clone->ops + offset;
+    if (!*(uint64_t *)fp_addr) return -HOOK_BAD_ADDRESS;
+    // the clone is in kp rw memory, no page table change
+    return fp_hook_wrap(fp_addr, argno, before, after, udata);
+}
+KP_EXPORT_SYMBOL(fp_ops_clone_wrap);
+
+hook_err_t fp_ops_clone_restore(fp_ops_clone_t *clone)
+{
+    if (!clone) return -HOOK_BAD_ADDRESS;
+    hook_lock();
+    void *cur = kp_cmpxchg_ptr(clone->slot, clone->ops, clone->origin_ops);
+    if (cur != clone->ops) {
+        hook_unlock();
+        logkfw("Restore ops: %llx changed to %llx, keep clone %llx\n", clone->slot, cur, clone->ops);
+        return -HOOK_SLOT_CHANGED;
+    }
+    for (int32_t i = 0; i < clone->ops_size / 8; i++) {
+        uintptr_t fp_addr = (uintptr_t)(clone->ops + i);
+        fp_hook_chain_t *chain = (fp_hook_chain_t *)hook_get_mem_from_origin(fp_addr);
+        // callers that loaded the clone before the restore still reach the chain
+        if (chain) hook_chain_kill(chain);
+    }
+    hook_clone_kill(clone);
+    hook_unlock();
+    logkv("Restore ops: %llx, %llx\n", clone->slot, clone->origin_ops);
+    return HOOK_NO_ERR;
 }
-KP_EXPORT_SYMBOL(fp_hook_unwrap);
\ No newline at end of file
+KP_EXPORT_SYMBOL(fp_ops_clone_restore);
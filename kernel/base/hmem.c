@@ -6,23 +6,53 @@
 #include "hook.h"
 
 #include <stdint.h>
+#include <pgtable.h>
+#include <preset.h>
+#include <kpmalloc.h>
+#include "hmem.h"
 
-static uint64_t mem_region_start = 0;
-static uint64_t mem_region_end = 0;
+#define HOOK_MEM_PAGE_MAX (HOOK_ALLOC_SIZE >> 12)
+#define HOOK_MEM_PAGE_FREE 0xff
 
-typedef struct
+typedef struct _hook_mem_head
 {
-    int using;
-    enum hook_type type;
-    uintptr_t addr;
-    // must align 8
     union
     {
-        hook_t inl;
-        hook_chain_t inl_chain;
-        fp_hook_chain_t fp_chain;
-    } chain __attribute__((aligned(8)));
-} hook_mem_warp_t __attribute__((aligned(16)));
+        uintptr_t addr;
+        struct _hook_mem_head *next_free;
+    };
+    int8_t using;
+    int8_t cls;
+    int16_t type;
+    uint32_t dying; // hook_reclaim generation when unwrapped, 0 in use
+} hook_mem_head_t __attribute__((aligned(16)));
+
+typedef struct
+{
+    int32_t obj_size;
+    int32_t slot_size;
+    int32_t is_text;
+    uint64_t cur;
+    uint64_t cur_end;
+    hook_mem_head_t *free;
+} hook_mem_arena_t;
+
+#define slot_size_of(obj) ((sizeof(hook_mem_head_t) + sizeof(obj) + 15) & ~15)
+
+static hook_mem_arena_t arenas[HOOK_MEM_CLASS_NUM] = {
+    [HOOK_MEM_HOOK] = { sizeof(hook_t), slot_size_of(hook_t), 1 },
+    [HOOK_MEM_TRANSIT] = { sizeof(hook_transit_t), slot_size_of(hook_transit_t), 1 },
+    [HOOK_MEM_CHAIN] = { sizeof(hook_chain_t), slot_size_of(hook_chain_t), 1 },
+    [HOOK_MEM_FP_CHAIN] = { sizeof(fp_hook_chain_t), slot_size_of(fp_hook_chain_t), 0 },
+};
+
+static uint64_t mem_region_start = 0;
+static uint64_t mem_region_end = 0;
+static uint64_t mem_page_size = 0;
+static int32_t mem_page_num = 0;
+static int32_t text_page_top = 0;
+static int32_t data_page_bottom = 0;
+static uint8_t page_class[HOOK_MEM_PAGE_MAX];
 
 int hook_mem_add(uint64_t start, int32_t size)
 {
@@ -31,48 +61,327 @@ int hook_mem_add(uint64_t start, int32_t size)
     }
     mem_region_start = start;
     mem_region_end = start + size;
+    mem_page_size = page_size;
+    mem_page_num = size / mem_page_size;
+    if (mem_page_num > HOOK_MEM_PAGE_MAX) mem_page_num = HOOK_MEM_PAGE_MAX;
+    text_page_top = 0;
+    data_page_bottom = mem_page_num;
+    for (int i = 0; i < HOOK_MEM_PAGE_MAX; i++) {
+        page_class[i] = HOOK_MEM_PAGE_FREE;
+    }
     return 0;
 }
 
+static int arena_grow(hook_mem_arena_t *arena, enum hook_mem_class cls)
+{
+    if (text_page_top >= data_page_bottom) return -1;
+    int32_t page = arena->is_text ? text_page_top++ : --data_page_bottom;
+    page_class[page] = cls;
+    arena->cur = mem_region_start + page * mem_page_size;
+    arena->cur_end = arena->cur + mem_page_size;
+    return 0;
+}
+
+static void *arena_zalloc(enum hook_mem_class cls, uintptr_t origin_addr, enum hook_type type)
+{
+    hook_mem_arena_t *arena = &arenas[cls];
+    hook_mem_head_t *head = arena->free;
+    if (head) {
+        arena->free = head->next_free;
+    } else {
+        if (arena->cur + arena->slot_size > arena->cur_end && arena_grow(arena, cls)) return 0;
+        head = (hook_mem_head_t *)arena->cur;
+        arena->cur += arena->slot_size;
+    }
+
+    head->using = 1;
+    head->cls = cls;
+    head->type = type;
+    head->dying = 0;
+    head->addr = origin_addr;
+
+    uint64_t obj = (uint64_t)(head + 1);
+    for (uint64_t i = obj; i < obj + arena->obj_size; i += 8) {
+        *(uint64_t *)i = 0;
+    }
+    return (void *)obj;
+}
+
+static enum hook_mem_class type_class(enum hook_type type)
+{
+    switch (type) {
+    case INLINE_CHAIN:
+        return HOOK_MEM_CHAIN;
+    case FUNCTION_POINTER_CHAIN:
+        return HOOK_MEM_FP_CHAIN;
+    default:
+        return HOOK_MEM_HOOK;
+    }
+}
+
 void *hook_mem_zalloc(uintptr_t origin_addr, enum hook_type type)
 {
-    uint64_t start = mem_region_start;
-    for (uint64_t addr = start; addr < mem_region_end; addr += sizeof(hook_mem_warp_t)) {
-        hook_mem_warp_t *wrap = (hook_mem_warp_t *)addr;
-        if (wrap->using) continue;
+    return arena_zalloc(type_class(type), origin_addr, type);
+}
 
-        wrap->using = 1;
-        wrap->addr = origin_addr;
-        wrap->type = type;
+void *hook_mem_class_zalloc(enum hook_mem_class cls)
+{
+    return arena_zalloc(cls, 0, NONE);
+}
 
-        for (uintptr_t i = (uintptr_t)&wrap->chain; i < (uintptr_t)&wrap->chain + sizeof(wrap->chain); i += 8) {
-            *(uint64_t *)i = 0;
-        }
+void hook_mem_free(void *hook_mem)
+{
+    if (!hook_mem) return;
+    hook_mem_head_t *head = (hook_mem_head_t *)hook_mem - 1;
+    hook_mem_arena_t *arena = &arenas[head->cls];
+    head->using = 0;
+    head->next_free = arena->free;
+    arena->free = head;
+}
 
-        // todo: assert
-        if (((uintptr_t)&wrap->chain) & 0b111) {
-            return 0;
+void *hook_get_mem_from_origin(uint64_t origin_addr)
+{
+    for (int32_t page = 0; page < mem_page_num; page++) {
+        int32_t cls = page_class[page];
+        if (cls == HOOK_MEM_PAGE_FREE || cls == HOOK_MEM_TRANSIT) continue;
+        hook_mem_arena_t *arena = &arenas[cls];
+        uint64_t start = mem_region_start + page * mem_page_size;
+        uint64_t end = start + mem_page_size;
+        for (uint64_t addr = start; addr + arena->slot_size <= end; addr += arena->slot_size) {
+            hook_mem_head_t *head = (hook_mem_head_t *)addr;
+            if (head->using && head->type != NONE && !head->dying && head->addr == origin_addr) {
+                return head + 1;
+            }
         }
-        return &wrap->chain;
     }
     return 0;
 }
 
-void hook_mem_free(void *hook_mem)
+enum hook_type hook_mem_type(void *hook_mem)
 {
-    hook_mem_warp_t *warp = local_container_of(hook_mem, hook_mem_warp_t, chain);
-    warp->using = 0;
+    hook_mem_head_t *head = (hook_mem_head_t *)hook_mem - 1;
+    return (enum hook_type)head->type;
 }
 
-void *hook_get_mem_from_origin(uint64_t origin_addr)
+// Unwrapped, not found by origin or visited by hook_mem_for_each any more, freed by hook_reclaim.
+void hook_mem_set_dying(void *hook_mem, uint32_t gen)
 {
-    uint64_t start = mem_region_start;
+    hook_mem_head_t *head = (hook_mem_head_t *)hook_mem - 1;
+    head->dying = gen;
+}
 
-    for (uint64_t addr = start; addr < mem_region_end; addr += sizeof(hook_mem_warp_t)) {
-        hook_mem_warp_t *wrap = (hook_mem_warp_t *)addr;
-        if (wrap->using && wrap->addr == origin_addr) {
-            return &wrap->chain;
+uint32_t hook_mem_dying(void *hook_mem)
+{
+    hook_mem_head_t *head = (hook_mem_head_t *)hook_mem - 1;
+    return head->dying;
+}
+
+static void mem_for_each(int (*fn)(void *hook_mem, enum hook_type type, void *udata), void *udata, int32_t dying)
+{
+    for (int32_t page = 0; page < mem_page_num; page++) {
+        int32_t cls = page_class[page];
+        if (cls == HOOK_MEM_PAGE_FREE || cls == HOOK_MEM_TRANSIT) continue;
+        hook_mem_arena_t *arena = &arenas[cls];
+        uint64_t start = mem_region_start + page * mem_page_size;
+        uint64_t end = start + mem_page_size;
+        for (uint64_t addr = start; addr + arena->slot_size <= end; addr += arena->slot_size) {
+            hook_mem_head_t *head = (hook_mem_head_t *)addr;
+            if (!head->using || head->type == NONE || !head->dying != !dying) continue;
+            if (fn(head + 1, (enum hook_type)head->type, udata)) return;
         }
     }
-    return 0;
+}
+
+// Visit every hook, chain and fp chain in use, stop when fn returns non-zero, the hook lock must be held.
+void hook_mem_for_each(int (*fn)(void *hook_mem, enum hook_type type, void *udata), void *udata)
+{
+    mem_for_each(fn, udata, 0);
+}
+
+// Visit every dying chain and fp chain.
+void hook_mem_for_each_dying(int (*fn)(void *hook_mem, enum hook_type type, void *udata), void *udata)
+{
+    mem_for_each(fn, udata, 1);
+}
+
+static hook_chain_items_t empty_items = { 0 };
+static void *(*items_owner)(void) = 0;
+
+void hook_chain_items_set_owner(void *(*owner)(void))
+{
+    items_owner = owner;
+}
+
+void hook_chain_items_init(hook_chain_items_t **items)
+{
+    *items = &empty_items;
+}
+
+static hook_chain_items_t *items_alloc(int32_t num)
+{
+    hook_chain_items_t *items = kp_malloc(sizeof(hook_chain_items_t) + num * sizeof(hook_chain_item_t));
+    if (items) {
+        items->num = num;
+        items->next = 0;
+    }
+    return items;
+}
+
+// Move new readers to the other counter if it is empty, see hook_readers_t.
+static int32_t readers_flip(hook_readers_t *readers)
+{
+    uint32_t idx = readers->idx & 1;
+    if (*(volatile int32_t *)&readers->count[idx ^ 1]) return 0;
+    *(volatile uint32_t *)&readers->idx = idx ^ 1;
+    readers->seq++;
+    dsb(ish);
+    return 1;
+}
+
+int32_t hook_chain_items_reclaim(hook_chain_items_t **retired, hook_readers_t *readers)
+{
+    if (!*retired) return 0;
+    // the newest array is first, two flips after it was replaced every array is unused
+    dsb(ish);
+    for (int32_t i = 0; i < 2 && readers->seq - (*retired)->seq < 2; i++) {
+        if (!readers_flip(readers)) break;
+    }
+    int32_t left = 0;
+    for (hook_chain_items_t **pos = retired; *pos;) {
+        hook_chain_items_t *cur = *pos;
+        if (readers->seq - cur->seq >= 2) {
+            *pos = cur->next;
+            kp_free(cur);
+        } else {
+            left++;
+            pos = &cur->next;
+        }
+    }
+    return left;
+}
+
+// Readers that loaded the replaced array may still walk it, it is kept on retired until they are done.
+static void items_publish(hook_chain_items_t **items, hook_chain_items_t **retired, hook_readers_t *readers,
+                          hook_chain_items_t *new_items)
+{
+    hook_chain_items_t *old = *items;
+    if (new_items != &empty_items) {
+        new_items->filtered = 0;
+        for (int32_t i = 0; i < new_items->num; i++) {
+            if (new_items->items[i].caller_num) new_items->filtered++;
+        }
+    }
+    dsb(ish);
+    *(hook_chain_items_t *volatile *)items = new_items;
+    dsb(ish);
+    if (old != &empty_items) {
+        old->seq = readers->seq;
+        old->next = *retired;
+        *retired = old;
+    }
+    hook_chain_items_reclaim(retired, readers);
+}
+
+hook_err_t hook_chain_items_add(hook_chain_items_t **items, hook_chain_items_t **retired, hook_readers_t *readers,
+                                void *before, void *after, void *udata, int32_t priority,
+                                const hook_caller_range_t *callers, int32_t caller_num)
+{
+    if (caller_num < 0 || caller_num > HOOK_CALLER_RANGE_NUM || (caller_num && !callers)) return -HOOK_BAD_ADDRESS;
+    hook_chain_items_t *cur = *items;
+    if ((cur->filtered || caller_num) && cur->num >= HOOK_CALLER_CHAIN_MAX) return -HOOK_CHAIN_FULL;
+    int32_t pos = cur->num;
+    for (int32_t i = 0; i < cur->num; i++) {
+        hook_chain_item_t *item = &cur->items[i];
+        if ((before && item->before == before) || (after && item->after == after)) return -HOOK_DUPLICATED;
+        if (pos == cur->num && item->priority < priority) pos = i;
+    }
+
+    hook_chain_items_t *new_items = items_alloc(cur->num + 1);
+    if (!new_items) return -HOOK_NO_MEM;
+
+    for (int32_t i = 0, j = 0; i < new_items->num; i++) {
+        hook_chain_item_t *item = &new_items->items[i];
+        if (i == pos) {
+            item->priority = priority;
+            item->udata = udata;
+            item->before = before;
+            item->after = after;
+            item->owner = items_owner ? items_owner() : 0;
+            item->caller_num = caller_num;
+            for (int32_t k = 0; k < caller_num; k++) {
+                item->callers[k] = callers[k];
+            }
+        } else {
+            *item = cur->items[j++];
+        }
+    }
+    items_publish(items, retired, readers, new_items);
+    return HOOK_NO_ERR;
+}
+
+int32_t hook_chain_items_remove(hook_chain_items_t **items, hook_chain_items_t **retired, hook_readers_t *readers,
+                                void *before, void *after)
+{
+    hook_chain_items_t *cur = *items;
+    int32_t pos = -1;
+    for (int32_t i = 0; i < cur->num; i++) {
+        hook_chain_item_t *item = &cur->items[i];
+        if ((before && item->before == before) || (after && item->after == after)) {
+            pos = i;
+            break;
+        }
+    }
+    if (pos < 0) return cur->num;
+
+    hook_chain_items_t *new_items = &empty_items;
+    if (cur->num > 1) {
+        new_items = items_alloc(cur->num - 1);
+        // keep the old array, the caller sees the item as still present
+        if (!new_items) return cur->num;
+        for (int32_t i = 0, j = 0; i < cur->num; i++) {
+            if (i != pos) new_items->items[j++] = cur->items[i];
+        }
+    }
+    items_publish(items, retired, readers, new_items);
+    return new_items->num;
+}
+
+// Free the current and every replaced array at once, only when no reader can be left.
+void hook_chain_items_release(hook_chain_items_t **items, hook_chain_items_t **retired)
+{
+    if (*items != &empty_items) kp_free(*items);
+    while (*retired) {
+        hook_chain_items_t *next = (*retired)->next;
+        kp_free(*retired);
+        *retired = next;
+    }
+    *items = &empty_items;
+}
+
+int32_t hook_chain_items_owned(hook_chain_items_t *items, void *owner)
+{
+    int32_t num = 0;
+    for (int32_t i = 0; i < items->num; i++) {
+        if (items->items[i].owner == owner) num++;
+    }
+    return num;
+}
+
+int32_t hook_chain_items_remove_owner(hook_chain_items_t **items, hook_chain_items_t **retired,
+                                      hook_readers_t *readers, void *owner)
+{
+    hook_chain_items_t *cur = *items;
+    int32_t remain = cur->num - hook_chain_items_owned(cur, owner);
+    if (remain == cur->num) return remain;
+
+    hook_chain_items_t *new_items = &empty_items;
+    if (remain) {
+        new_items = items_alloc(remain);
+        if (!new_items) return cur->num;
+        for (int32_t i = 0, j = 0; i < cur->num; i++) {
+            if (cur->items[i].owner != owner) new_items->items[j++] = cur->items[i];
+        }
+    }
+    items_publish(items, retired, readers, new_items);
+    return remain;
 }
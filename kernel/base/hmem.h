@@ -8,9 +8,46 @@
 
 #include <stdint.h>
 
+// Text classes take pages from the start of the region, data classes from the end,
+// so executable and data-only objects never share a page.
+enum hook_mem_class
+{
+    HOOK_MEM_HOOK = 0, // hook_t, text
+    HOOK_MEM_TRANSIT, // hook_transit_t, text
+    HOOK_MEM_CHAIN, // hook_chain_t, text, it embeds the relocated instructions of its hook_t
+    HOOK_MEM_FP_CHAIN, // fp_hook_chain_t, data
+    HOOK_MEM_CLASS_NUM,
+};
+
 int hook_mem_add(uint64_t start, int32_t size);
 void *hook_mem_zalloc(uintptr_t origin_addr, enum hook_type type);
+void *hook_mem_class_zalloc(enum hook_mem_class cls);
 void hook_mem_free(void *hook_mem);
 void *hook_get_mem_from_origin(uint64_t origin_addr);
+enum hook_type hook_mem_type(void *hook_mem);
+void hook_mem_for_each(int (*fn)(void *hook_mem, enum hook_type type, void *udata), void *udata);
+void hook_mem_for_each_dying(int (*fn)(void *hook_mem, enum hook_type type, void *udata), void *udata);
+void hook_mem_set_dying(void *hook_mem, uint32_t gen);
+uint32_t hook_mem_dying(void *hook_mem);
+
+void hook_chain_items_init(hook_chain_items_t **items);
+hook_err_t hook_chain_items_add(hook_chain_items_t **items, hook_chain_items_t **retired, hook_readers_t *readers,
+                                void *before, void *after, void *udata, int32_t priority,
+                                const hook_caller_range_t *callers, int32_t caller_num);
+int32_t hook_chain_items_remove(hook_chain_items_t **items, hook_chain_items_t **retired, hook_readers_t *readers,
+                                void *before, void *after);
+void hook_chain_items_release(hook_chain_items_t **items, hook_chain_items_t **retired);
+void hook_chain_items_set_owner(void *(*owner)(void));
+int32_t hook_chain_items_owned(hook_chain_items_t *items, void *owner);
+int32_t hook_chain_items_remove_owner(hook_chain_items_t **items, hook_chain_items_t **retired,
+                                      hook_readers_t *readers, void *owner);
+int32_t hook_chain_items_reclaim(hook_chain_items_t **retired, hook_readers_t *readers);
+
+// Chains unwrapped by hook_unwrap_remove and fp_hook_unwrap, freed by hook_reclaim.
+void hook_chain_kill(void *chain);
+void hook_clone_kill(fp_ops_clone_t *clone);
+
+// Stack layout set by hook_set_stack, every transit points to it.
+extern hook_stack_t hook_stack;
 
-#endif
\ No newline at end of file
+#endif
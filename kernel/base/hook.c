@@ -9,6 +9,7 @@
 #include <kpmalloc.h>
 #include <io.h>
 #include <symbol.h>
+#include <kplock.h>
 #include "hmem.h"
 
 #define bits32(n, high, low) ((uint32_t)((n) << (31u - (high))) >> (31u - (high) + (low)))
@@ -58,18 +59,83 @@ typedef uint32_t inst_mask_t;
 #define MASK_HINT 0xFFFFF01F
 #define MASK_IGNORE 0x0
 
-static inst_mask_t masks[] = {
-    MASK_B,      MASK_BC,        MASK_BL,       MASK_ADR,         MASK_ADRP,        MASK_LDR_32,
-    MASK_LDR_64, MASK_LDRSW_LIT, MASK_PRFM_LIT, MASK_LDR_SIMD_32, MASK_LDR_SIMD_64, MASK_LDR_SIMD_128,
-    MASK_CBZ,    MASK_CBNZ,      MASK_TBZ,      MASK_TBNZ,        MASK_IGNORE,
+enum relo_class
+{
+    RELO_IGNORE = 0,
+    RELO_B,
+    RELO_ADR,
+    RELO_LDR,
+    RELO_CB,
+    RELO_TB,
+    RELO_CLASS_NUM,
+};
+
+typedef struct
+{
+    inst_mask_t mask;
+    inst_type_t type;
+    int32_t len; // relocated length in instructions
+    int32_t cls;
+} inst_decode_t;
+
+typedef struct
+{
+    const inst_decode_t *decodes;
+    int32_t num;
+} inst_group_t;
+
+// A64 top-level encoding is selected by op0, bits 28:25, only these groups hold pc-relative instructions.
+// 100x, data processing - immediate
+static const inst_decode_t decode_dp_imm[] = {
+    { MASK_ADR, INST_ADR, 4, RELO_ADR },
+    { MASK_ADRP, INST_ADRP, 4, RELO_ADR },
+};
+// 101x, branches, exception generating and system, bit 25 is imm26[25] of B and BL
+static const inst_decode_t decode_branch_0[] = {
+    { MASK_B, INST_B, 6, RELO_B },
+    { MASK_BL, INST_BL, 8, RELO_B },
+    { MASK_BC, INST_BC, 8, RELO_B },
+    { MASK_CBZ, INST_CBZ, 6, RELO_CB },
+    { MASK_CBNZ, INST_CBNZ, 6, RELO_CB },
+};
+static const inst_decode_t decode_branch_1[] = {
+    { MASK_B, INST_B, 6, RELO_B },
+    { MASK_BL, INST_BL, 8, RELO_B },
+    { MASK_TBZ, INST_TBZ, 6, RELO_TB },
+    { MASK_TBNZ, INST_TBNZ, 6, RELO_TB },
 };
-static inst_type_t types[] = {
-    INST_B,      INST_BC,        INST_BL,       INST_ADR,         INST_ADRP,        INST_LDR_32,
-    INST_LDR_64, INST_LDRSW_LIT, INST_PRFM_LIT, INST_LDR_SIMD_32, INST_LDR_SIMD_64, INST_LDR_SIMD_128,
-    INST_CBZ,    INST_CBNZ,      INST_TBZ,      INST_TBNZ,        INST_IGNORE,
+// x1x0, loads and stores, load register (literal) has op0 1100 or 1110 by its V bit
+static const inst_decode_t decode_ldr_lit[] = {
+    { MASK_LDR_32, INST_LDR_32, 6, RELO_LDR },
+    { MASK_LDR_64, INST_LDR_64, 6, RELO_LDR },
+    { MASK_LDRSW_LIT, INST_LDRSW_LIT, 6, RELO_LDR },
+    { MASK_PRFM_LIT, INST_PRFM_LIT, 8, RELO_LDR },
+};
+static const inst_decode_t decode_ldr_simd_lit[] = {
+    { MASK_LDR_SIMD_32, INST_LDR_SIMD_32, 8, RELO_LDR },
+    { MASK_LDR_SIMD_64, INST_LDR_SIMD_64, 8, RELO_LDR },
+    { MASK_LDR_SIMD_128, INST_LDR_SIMD_128, 8, RELO_LDR },
+};
+static const inst_decode_t decode_ignore = { MASK_IGNORE, INST_IGNORE, 2, RELO_IGNORE };
+
+#define inst_group(decodes) { decodes, sizeof(decodes) / sizeof(decodes[0]) }
+
+static const inst_group_t inst_groups[16] = {
+    [0x8] = inst_group(decode_dp_imm),
+    [0xa] = inst_group(decode_branch_0),
+    [0xb] = inst_group(decode_branch_1),
+    [0xc] = inst_group(decode_ldr_lit),
+    [0xe] = inst_group(decode_ldr_simd_lit),
 };
 
-static int32_t relo_len[] = { 6, 8, 8, 4, 4, 6, 6, 6, 8, 8, 8, 8, 6, 6, 6, 6, 2 };
+static const inst_decode_t *inst_decode(uint32_t inst)
+{
+    const inst_group_t *group = &inst_groups[bits32(inst, 28, 25)];
+    for (int32_t i = 0; i < group->num; i++) {
+        if ((inst & group->decodes[i].mask) == group->decodes[i].type) return &group->decodes[i];
+    }
+    return &decode_ignore;
+}
 
 // static uint64_t sign_extend(uint64_t x, uint32_t len)
 // {
@@ -97,13 +163,7 @@ static uint64_t relo_in_tramp(hook_t *hook, uint64_t addr)
     uint32_t addr_inst_index = (addr - tramp_start) / 4;
     uint64_t fix_addr = hook->relo_addr;
     for (int i = 0; i < addr_inst_index; i++) {
-        inst_type_t inst = hook->origin_insts[i];
-        for (int j = 0; j < sizeof(relo_len) / sizeof(relo_len[0]); j++) {
-            if ((inst & masks[j]) == types[j]) {
-                fix_addr += relo_len[j] * 4;
-                break;
-            }
-        }
+        fix_addr += inst_decode(hook->origin_insts[i])->len * 4;
     }
     return fix_addr;
 }
@@ -138,6 +198,14 @@ uint64_t branch_func_addr(uint64_t addr)
 
 #endif
 
+// imm26 of B/BL, offsets in [-128MB, 128MB - 4]
+static uint32_t can_b_rel(uint64_t src_addr, uint64_t dst_addr)
+{
+#define B_REL_RANGE ((int64_t)(1 << 25) << 2)
+    int64_t off = (int64_t)(dst_addr - src_addr);
+    return off >= -B_REL_RANGE && off < B_REL_RANGE;
+}
+
 static __noinline hook_err_t relo_b(hook_t *hook, uint64_t inst_addr, uint32_t inst, inst_type_t type)
 {
     uint32_t *buf = hook->relo_insts + hook->relo_insts_num;
@@ -153,6 +221,11 @@ static __noinline hook_err_t relo_b(hook_t *hook, uint64_t inst_addr, uint32_t i
     addr = relo_in_tramp(hook, addr);
 
     uint32_t idx = 0;
+    // direct branch keeps the return stack balanced, the rest of the relocated length is padded with nops
+    if (type != INST_BC && can_b_rel((uint64_t)buf, addr)) {
+        buf[0] = (inst & MASK_B) | (((addr - (uint64_t)buf) & 0x0FFFFFFFu) >> 2u); // B/BL <label>
+        return HOOK_NO_ERR;
+    }
     if (type == INST_BC) {
         buf[idx++] = (inst & 0xFF00001F) | 0x40u; // B.<cond> #8
         buf[idx++] = 0x14000006; // B #24
@@ -287,17 +360,19 @@ static __noinline hook_err_t relo_ignore(hook_t *hook, uint64_t inst_addr, uint3
     return HOOK_NO_ERR;
 }
 
-static uint32_t can_b_rel(uint64_t src_addr, uint64_t dst_addr)
+// a single B, the trampoline and jump back need no padding
+static int32_t branch_relative_one(uint32_t *buf, uint64_t src_addr, uint64_t dst_addr)
 {
-#define B_REL_RANGE ((1 << 25) << 2)
-    return ((dst_addr >= src_addr) & (dst_addr - src_addr <= B_REL_RANGE)) ||
-           ((src_addr >= dst_addr) & (src_addr - dst_addr <= B_REL_RANGE));
+    if (can_b_rel(src_addr, dst_addr)) {
+        buf[0] = 0x14000000u | (((dst_addr - src_addr) & 0x0FFFFFFFu) >> 2u); // B <label>
+        return 1;
+    }
+    return 0;
 }
 
 int32_t branch_relative(uint32_t *buf, uint64_t src_addr, uint64_t dst_addr)
 {
-    if (can_b_rel(src_addr, dst_addr)) {
-        buf[0] = 0x14000000u | (((dst_addr - src_addr) & 0x0FFFFFFFu) >> 2u); // B <label>
+    if (branch_relative_one(buf, src_addr, dst_addr)) {
         buf[1] = ARM64_NOP;
         return 2;
     }
@@ -325,18 +400,26 @@ int32_t ret_absolute(uint32_t *buf, uint64_t addr)
 }
 KP_EXPORT_SYMBOL(ret_absolute);
 
+/**
+ * @brief Branch to a landing pad, dst_addr must start with bti c/jc or be unguarded.
+ * A single B if in range, else BR X17, which bti c accepts.
+ */
 int32_t branch_from_to(uint32_t *tramp_buf, uint64_t src_addr, uint64_t dst_addr)
 {
-#if 0
-    uint32_t len = branch_relative(tramp_buf, src_addr, dst_addr);
+    uint32_t len = branch_relative_one(tramp_buf, src_addr, dst_addr);
     if (len) return len;
-#else
-#if 0
     return branch_absolute(tramp_buf, dst_addr);
-#else
-    return ret_absolute(tramp_buf, dst_addr);
-#endif
-#endif
+}
+
+/**
+ * @brief Branch back into the middle of a function, there is no landing pad,
+ * fall back to RET X17 which is not checked by bti.
+ */
+static int32_t branch_back_to(uint32_t *buf, uint64_t src_addr, uint64_t dst_addr)
+{
+    uint32_t len = branch_relative_one(buf, src_addr, dst_addr);
+    if (len) return len;
+    return ret_absolute(buf, dst_addr);
 }
 
 // transit0
@@ -350,24 +433,35 @@ uint64_t __attribute__((section(".transit0.text"))) __attribute__((__noinline__)
     while (*--vptr != ARM64_NOP) {
     };
     vptr--;
-    hook_chain_t *hook_chain = local_container_of((uint64_t)vptr, hook_chain_t, transit);
+    hook_transit_t *transit = local_container_of((uint64_t)vptr, hook_transit_t, insts);
+    hook_chain_t *hook_chain = transit->chain;
+    uint32_t ridx = hook_readers_enter(&hook_chain->readers);
+    hook_chain_items_t *items = *(hook_chain_items_t *volatile *)&hook_chain->items;
+    uint64_t skip = 0;
+    int direct = (hook_chain->flags & HOOK_CHAIN_NO_REENTRY) && hook_transit_nested(transit);
+    if (!direct && items->filtered) skip = hook_items_caller_skip(items, (uint64_t)__builtin_return_address(0), &direct);
+    if (direct) {
+        uint64_t ret = ((transit0_func_t)hook_chain->hook.relo_addr)();
+        hook_readers_exit(&hook_chain->readers, ridx);
+        return ret;
+    }
+    if (hook_chain->flags & HOOK_CHAIN_COUNT_CALLS) hook_chain->calls++;
     hook_fargs0_t fargs;
     fargs.skip_origin = 0;
     fargs.chain = hook_chain;
-    for (int32_t i = 0; i < hook_chain->chain_items_max; i++) {
-        if (hook_chain->states[i] != CHAIN_ITEM_STATE_READY) continue;
-        hook_chain0_callback func = hook_chain->befores[i];
-        if (func) func(&fargs, hook_chain->udata[i]);
+    for (int32_t i = 0; i < items->num; i++) {
+        hook_chain0_callback func = items->items[i].before;
+        if (func && !(skip >> i & 1)) func(&fargs, items->items[i].udata);
     }
     if (!fargs.skip_origin) {
         transit0_func_t origin_func = (transit0_func_t)hook_chain->hook.relo_addr;
         fargs.ret = origin_func();
     }
-    for (int32_t i = hook_chain->chain_items_max - 1; i >= 0; i--) {
-        if (hook_chain->states[i] != CHAIN_ITEM_STATE_READY) continue;
-        hook_chain0_callback func = hook_chain->afters[i];
-        if (func) func(&fargs, hook_chain->udata[i]);
+    for (int32_t i = items->num - 1; i >= 0; i--) {
+        hook_chain0_callback func = items->items[i].after;
+        if (func && !(skip >> i & 1)) func(&fargs, items->items[i].udata);
     }
+    hook_readers_exit(&hook_chain->readers, ridx);
     return fargs.ret;
 }
 extern void _transit0_end();
@@ -384,7 +478,19 @@ _transit4(uint64_t arg0, uint64_t arg1, uint64_t arg2, uint64_t arg3)
     while (*--vptr != ARM64_NOP) {
     };
     vptr--;
-    hook_chain_t *hook_chain = local_container_of((uint64_t)vptr, hook_chain_t, transit);
+    hook_transit_t *transit = local_container_of((uint64_t)vptr, hook_transit_t, insts);
+    hook_chain_t *hook_chain = transit->chain;
+    uint32_t ridx = hook_readers_enter(&hook_chain->readers);
+    hook_chain_items_t *items = *(hook_chain_items_t *volatile *)&hook_chain->items;
+    uint64_t skip = 0;
+    int direct = (hook_chain->flags & HOOK_CHAIN_NO_REENTRY) && hook_transit_nested(transit);
+    if (!direct && items->filtered) skip = hook_items_caller_skip(items, (uint64_t)__builtin_return_address(0), &direct);
+    if (direct) {
+        uint64_t ret = ((transit4_func_t)hook_chain->hook.relo_addr)(arg0, arg1, arg2, arg3);
+        hook_readers_exit(&hook_chain->readers, ridx);
+        return ret;
+    }
+    if (hook_chain->flags & HOOK_CHAIN_COUNT_CALLS) hook_chain->calls++;
     hook_fargs4_t fargs;
     fargs.skip_origin = 0;
     fargs.arg0 = arg0;
@@ -392,20 +498,19 @@ _transit4(uint64_t arg0, uint64_t arg1, uint64_t arg2, uint64_t arg3)
     fargs.arg2 = arg2;
     fargs.arg3 = arg3;
     fargs.chain = hook_chain;
-    for (int32_t i = 0; i < hook_chain->chain_items_max; i++) {
-        if (hook_chain->states[i] != CHAIN_ITEM_STATE_READY) continue;
-        hook_chain4_callback func = hook_chain->befores[i];
-        if (func) func(&fargs, hook_chain->udata[i]);
+    for (int32_t i = 0; i < items->num; i++) {
+        hook_chain4_callback func = items->items[i].before;
+        if (func && !(skip >> i & 1)) func(&fargs, items->items[i].udata);
     }
     if (!fargs.skip_origin) {
         transit4_func_t origin_func = (transit4_func_t)hook_chain->hook.relo_addr;
         fargs.ret = origin_func(fargs.arg0, fargs.arg1, fargs.arg2, fargs.arg3);
     }
-    for (int32_t i = hook_chain->chain_items_max - 1; i >= 0; i--) {
-        if (hook_chain->states[i] != CHAIN_ITEM_STATE_READY) continue;
-        hook_chain4_callback func = hook_chain->afters[i];
-        if (func) func(&fargs, hook_chain->udata[i]);
+    for (int32_t i = items->num - 1; i >= 0; i--) {
+        hook_chain4_callback func = items->items[i].after;
+        if (func && !(skip >> i & 1)) func(&fargs, items->items[i].udata);
     }
+    hook_readers_exit(&hook_chain->readers, ridx);
     return fargs.ret;
 }
 
@@ -424,7 +529,19 @@ _transit8(uint64_t arg0, uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t a
     while (*--vptr != ARM64_NOP) {
     };
     vptr--;
-    hook_chain_t *hook_chain = local_container_of((uint64_t)vptr, hook_chain_t, transit);
+    hook_transit_t *transit = local_container_of((uint64_t)vptr, hook_transit_t, insts);
+    hook_chain_t *hook_chain = transit->chain;
+    uint32_t ridx = hook_readers_enter(&hook_chain->readers);
+    hook_chain_items_t *items = *(hook_chain_items_t *volatile *)&hook_chain->items;
+    uint64_t skip = 0;
+    int direct = (hook_chain->flags & HOOK_CHAIN_NO_REENTRY) && hook_transit_nested(transit);
+    if (!direct && items->filtered) skip = hook_items_caller_skip(items, (uint64_t)__builtin_return_address(0), &direct);
+    if (direct) {
+        uint64_t ret = ((transit8_func_t)hook_chain->hook.relo_addr)(arg0, arg1, arg2, arg3, arg4, arg5, arg6, arg7);
+        hook_readers_exit(&hook_chain->readers, ridx);
+        return ret;
+    }
+    if (hook_chain->flags & HOOK_CHAIN_COUNT_CALLS) hook_chain->calls++;
     hook_fargs8_t fargs;
     fargs.skip_origin = 0;
     fargs.arg0 = arg0;
@@ -436,21 +553,20 @@ _transit8(uint64_t arg0, uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t a
     fargs.arg6 = arg6;
     fargs.arg7 = arg7;
     fargs.chain = hook_chain;
-    for (int32_t i = 0; i < hook_chain->chain_items_max; i++) {
-        if (hook_chain->states[i] != CHAIN_ITEM_STATE_READY) continue;
-        hook_chain8_callback func = hook_chain->befores[i];
-        if (func) func(&fargs, hook_chain->udata[i]);
+    for (int32_t i = 0; i < items->num; i++) {
+        hook_chain8_callback func = items->items[i].before;
+        if (func && !(skip >> i & 1)) func(&fargs, items->items[i].udata);
     }
     if (!fargs.skip_origin) {
         transit8_func_t origin_func = (transit8_func_t)hook_chain->hook.relo_addr;
         fargs.ret =
             origin_func(fargs.arg0, fargs.arg1, fargs.arg2, fargs.arg3, fargs.arg4, fargs.arg5, fargs.arg6, fargs.arg7);
     }
-    for (int32_t i = hook_chain->chain_items_max - 1; i >= 0; i--) {
-        if (hook_chain->states[i] != CHAIN_ITEM_STATE_READY) continue;
-        hook_chain8_callback func = hook_chain->afters[i];
-        if (func) func(&fargs, hook_chain->udata[i]);
+    for (int32_t i = items->num - 1; i >= 0; i--) {
+        hook_chain8_callback func = items->items[i].after;
+        if (func && !(skip >> i & 1)) func(&fargs, items->items[i].udata);
     }
+    hook_readers_exit(&hook_chain->readers, ridx);
     return fargs.ret;
 }
 
@@ -470,7 +586,19 @@ _transit12(uint64_t arg0, uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t
     while (*--vptr != ARM64_NOP) {
     };
     vptr--;
-    hook_chain_t *hook_chain = local_container_of((uint64_t)vptr, hook_chain_t, transit);
+    hook_transit_t *transit = local_container_of((uint64_t)vptr, hook_transit_t, insts);
+    hook_chain_t *hook_chain = transit->chain;
+    uint32_t ridx = hook_readers_enter(&hook_chain->readers);
+    hook_chain_items_t *items = *(hook_chain_items_t *volatile *)&hook_chain->items;
+    uint64_t skip = 0;
+    int direct = (hook_chain->flags & HOOK_CHAIN_NO_REENTRY) && hook_transit_nested(transit);
+    if (!direct && items->filtered) skip = hook_items_caller_skip(items, (uint64_t)__builtin_return_address(0), &direct);
+    if (direct) {
+        uint64_t ret = ((transit12_func_t)hook_chain->hook.relo_addr)(arg0, arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8, arg9, arg10, arg11);
+        hook_readers_exit(&hook_chain->readers, ridx);
+        return ret;
+    }
+    if (hook_chain->flags & HOOK_CHAIN_COUNT_CALLS) hook_chain->calls++;
     hook_fargs12_t fargs;
     fargs.skip_origin = 0;
     fargs.arg0 = arg0;
@@ -486,75 +614,37 @@ _transit12(uint64_t arg0, uint64_t arg1, uint64_t arg2, uint64_t arg3, uint64_t
     fargs.arg10 = arg10;
     fargs.arg11 = arg11;
     fargs.chain = hook_chain;
-    for (int32_t i = 0; i < hook_chain->chain_items_max; i++) {
-        if (hook_chain->states[i] != CHAIN_ITEM_STATE_READY) continue;
-        hook_chain12_callback func = hook_chain->befores[i];
-        if (func) func(&fargs, hook_chain->udata[i]);
+    for (int32_t i = 0; i < items->num; i++) {
+        hook_chain12_callback func = items->items[i].before;
+        if (func && !(skip >> i & 1)) func(&fargs, items->items[i].udata);
     }
     if (!fargs.skip_origin) {
         transit12_func_t origin_func = (transit12_func_t)hook_chain->hook.relo_addr;
         fargs.ret = origin_func(fargs.arg0, fargs.arg1, fargs.arg2, fargs.arg3, fargs.arg4, fargs.arg5, fargs.arg6,
                                 fargs.arg7, fargs.arg8, fargs.arg9, fargs.arg10, fargs.arg11);
     }
-    for (int32_t i = hook_chain->chain_items_max - 1; i >= 0; i--) {
-        if (hook_chain->states[i] != CHAIN_ITEM_STATE_READY) continue;
-        hook_chain12_callback func = hook_chain->afters[i];
-        if (func) func(&fargs, hook_chain->udata[i]);
+    for (int32_t i = items->num - 1; i >= 0; i--) {
+        hook_chain12_callback func = items->items[i].after;
+        if (func && !(skip >> i & 1)) func(&fargs, items->items[i].udata);
     }
+    hook_readers_exit(&hook_chain->readers, ridx);
     return fargs.ret;
 }
 
 extern void _transit12_end();
 
-static __noinline hook_err_t relocate_inst(hook_t *hook, uint64_t inst_addr, uint32_t inst)
-{
-    hook_err_t rc = HOOK_NO_ERR;
-    inst_type_t it = INST_IGNORE;
-    int len = 1;
+typedef hook_err_t (*relo_func_t)(hook_t *hook, uint64_t inst_addr, uint32_t inst, inst_type_t type);
 
-    for (int j = 0; j < sizeof(relo_len) / sizeof(relo_len[0]); j++) {
-        if ((inst & masks[j]) == types[j]) {
-            it = types[j];
-            len = relo_len[j];
-            break;
-        }
-    }
-
-    switch (it) {
-    case INST_B:
-    case INST_BC:
-    case INST_BL:
-        rc = relo_b(hook, inst_addr, inst, it);
-        break;
-    case INST_ADR:
-    case INST_ADRP:
-        rc = relo_adr(hook, inst_addr, inst, it);
-        break;
-    case INST_LDR_32:
-    case INST_LDR_64:
-    case INST_LDRSW_LIT:
-    case INST_PRFM_LIT:
-    case INST_LDR_SIMD_32:
-    case INST_LDR_SIMD_64:
-    case INST_LDR_SIMD_128:
-        rc = relo_ldr(hook, inst_addr, inst, it);
-        break;
-    case INST_CBZ:
-    case INST_CBNZ:
-        rc = relo_cb(hook, inst_addr, inst, it);
-        break;
-    case INST_TBZ:
-    case INST_TBNZ:
-        rc = relo_tb(hook, inst_addr, inst, it);
-        break;
-    case INST_IGNORE:
-    default:
-        rc = relo_ignore(hook, inst_addr, inst, it);
-        break;
-    }
-
-    hook->relo_insts_num += len;
+static const relo_func_t relo_funcs[RELO_CLASS_NUM] = {
+    [RELO_IGNORE] = relo_ignore, [RELO_B] = relo_b,   [RELO_ADR] = relo_adr,
+    [RELO_LDR] = relo_ldr,       [RELO_CB] = relo_cb, [RELO_TB] = relo_tb,
+};
 
+static __noinline hook_err_t relocate_inst(hook_t *hook, uint64_t inst_addr, uint32_t inst)
+{
+    const inst_decode_t *decode = inst_decode(inst);
+    hook_err_t rc = relo_funcs[decode->cls](hook, inst_addr, inst, decode->type);
+    hook->relo_insts_num += decode->len;
     return rc;
 }
 
@@ -595,7 +685,7 @@ hook_err_t hook_prepare(hook_t *hook)
     uint64_t back_src_addr = hook->relo_addr + hook->relo_insts_num * 4;
     uint64_t back_dst_addr = hook->origin_addr + hook->tramp_insts_num * 4;
     uint32_t *buf = hook->relo_insts + hook->relo_insts_num;
-    hook->relo_insts_num += branch_from_to(buf, back_src_addr, back_dst_addr);
+    hook->relo_insts_num += branch_back_to(buf, back_src_addr, back_dst_addr);
     return HOOK_NO_ERR;
 }
 KP_EXPORT_SYMBOL(hook_prepare);
@@ -639,8 +729,12 @@ hook_err_t hook(void *func, void *replace, void **backup)
         return -HOOK_BAD_ADDRESS;
     }
     uint64_t origin_addr = branch_func_addr((uintptr_t)func);
+    hook_lock();
     hook_t *hook = (hook_t *)hook_mem_zalloc(origin_addr, INLINE);
-    if (!hook) return -HOOK_NO_MEM;
+    if (!hook) {
+        hook_unlock();
+        return -HOOK_NO_MEM;
+    }
     hook->func_addr = (uint64_t)func;
     hook->origin_addr = origin_addr;
     hook->replace_addr = (uint64_t)replace;
@@ -651,11 +745,13 @@ hook_err_t hook(void *func, void *replace, void **backup)
     err = hook_prepare(hook);
     if (err) goto out;
     hook_install(hook);
+    hook_unlock();
     logkv("Hook func: %llx succsseed\n", hook->func_addr);
     return HOOK_NO_ERR;
 out:
     hook_mem_free(hook);
-    logkv("Hook func: %llx failed, err: %d\n", hook->func_addr, err);
+    hook_unlock();
+    logkv("Hook func: %llx failed, err: %d\n", func, err);
     return err;
 }
 KP_EXPORT_SYMBOL(hook);
@@ -663,11 +759,17 @@ KP_EXPORT_SYMBOL(hook);
 void unhook(void *func)
 {
     uint64_t origin = branch_func_addr((uint64_t)func);
-    hook_t *hook = hook_get_mem_from_origin(origin);
-    if (!hook) return;
-    hook_uninstall(hook);
-    hook_mem_free(hook);
-    logkv("Unhook func: %llx\n", func);
+    hook_lock();
+    void *mem = hook_get_mem_from_origin(origin);
+    enum hook_type type = mem ? hook_mem_type(mem) : NONE;
+    if (type == INLINE) {
+        hook_uninstall((hook_t *)mem);
+        hook_mem_free(mem);
+    }
+    hook_unlock();
+    if (type == INLINE) logkv("Unhook func: %llx\n", func);
+    // a chain has its own records and readers, only hook_unwrap removes it
+    if (type == INLINE_CHAIN) logkfw("Unhook func: %llx is wrapped, use hook_unwrap\n", func);
 }
 KP_EXPORT_SYMBOL(unhook);
 
@@ -701,7 +803,7 @@ static hook_err_t hook_chain_prepare(uint32_t *transit, int32_t argno)
 
     int32_t transit_num = (transit_end - transit_start) / 4;
     // todo:assert
-    if (transit_num >= TRANSIT_INST_NUM) return -HOOK_TRANSIT_NO_MEM;
+    if (transit_num + 2 > TRANSIT_INST_NUM) return -HOOK_TRANSIT_NO_MEM;
 
     transit[0] = ARM64_BTI_JC;
     transit[1] = ARM64_NOP;
@@ -711,84 +813,189 @@ static hook_err_t hook_chain_prepare(uint32_t *transit, int32_t argno)
     return HOOK_NO_ERR;
 }
 
-hook_err_t hook_chain_add(hook_chain_t *chain, void *before, void *after, void *udata)
+static kp_lock_t hooks_lock = KP_LOCK_INIT;
+static void (*wait_relax)(void) = 0;
+static void (*wait_sync)(void) = 0;
+
+hook_stack_t hook_stack = { -1, 0 };
+// chains unwrapped now are freed by a hook_reclaim started later
+static uint32_t dying_gen = 1;
+
+void hook_lock()
+{
+    kp_lock(&hooks_lock);
+}
+KP_EXPORT_SYMBOL(hook_lock);
+
+void hook_unlock()
+{
+    kp_unlock(&hooks_lock);
+}
+KP_EXPORT_SYMBOL(hook_unlock);
+
+void hook_set_wait(void (*relax)(void), void (*sync)(void))
+{
+    wait_relax = relax;
+    wait_sync = sync;
+}
+KP_EXPORT_SYMBOL(hook_set_wait);
+
+void hook_set_stack(int32_t task_offset, int32_t size)
+{
+    hook_stack.task_offset = task_offset;
+    hook_stack.size = size;
+}
+KP_EXPORT_SYMBOL(hook_set_stack);
+
+void hook_chain_kill(void *chain)
+{
+    hook_mem_set_dying(chain, dying_gen);
+}
+
+static fp_ops_clone_t *dying_clones = 0;
+
+void hook_clone_kill(fp_ops_clone_t *clone)
 {
-    for (int i = 0; i < HOOK_CHAIN_NUM; i++) {
-        if ((before && chain->befores[i] == before) || (after && chain->afters[i] == after)) return -HOOK_DUPLICATED;
-
-        // todo: atomic or lock
-        if (chain->states[i] == CHAIN_ITEM_STATE_EMPTY) {
-            chain->states[i] = CHAIN_ITEM_STATE_BUSY;
-            dsb(ish);
-            chain->udata[i] = udata;
-            chain->befores[i] = before;
-            chain->afters[i] = after;
-            if (i + 1 > chain->chain_items_max) {
-                chain->chain_items_max = i + 1;
-            }
-            dsb(ish);
-            chain->states[i] = CHAIN_ITEM_STATE_READY;
-            logkv("Wrap chain add: %llx, %llx, %llx successed\n", chain->hook.func_addr, before, after);
-            return HOOK_NO_ERR;
+    clone->dying = dying_gen;
+    clone->next = dying_clones;
+    dying_clones = clone;
+}
+
+// Free restored clones, called after the wait of generation gen.
+static void clones_free(uint32_t gen)
+{
+    for (fp_ops_clone_t **pos = &dying_clones; *pos;) {
+        fp_ops_clone_t *clone = *pos;
+        if (clone->dying <= gen) {
+            *pos = (fp_ops_clone_t *)clone->next;
+            kp_free(clone);
+        } else {
+            pos = (fp_ops_clone_t **)&clone->next;
         }
     }
-    logkv("Wrap chain add: %llx, %llx, %llx failed\n", chain->hook.func_addr, before, after);
-    return -HOOK_CHAIN_FULL;
+}
+
+static hook_err_t chain_add(hook_chain_t *chain, void *before, void *after, void *udata, int32_t priority,
+                            const hook_caller_range_t *callers, int32_t caller_num)
+{
+    hook_err_t err = hook_chain_items_add(&chain->items, &chain->retired, &chain->readers, before, after, udata,
+                                          priority, callers, caller_num);
+    logkv("Wrap chain add: %llx, %llx, %llx, priority: %d, callers: %d, err: %d\n", chain->hook.func_addr, before,
+          after, priority, caller_num, err);
+    return err;
+}
+
+static int32_t chain_remove(hook_chain_t *chain, void *before, void *after)
+{
+    int32_t remain = hook_chain_items_remove(&chain->items, &chain->retired, &chain->readers, before, after);
+    logkv("Wrap chain remove: %llx, %llx, %llx\n", chain->hook.func_addr, before, after);
+    return remain;
+}
+
+hook_err_t hook_chain_add_priority(hook_chain_t *chain, void *before, void *after, void *udata, int32_t priority)
+{
+    hook_lock();
+    hook_err_t err = chain_add(chain, before, after, udata, priority, 0, 0);
+    hook_unlock();
+    return err;
+}
+KP_EXPORT_SYMBOL(hook_chain_add_priority);
+
+hook_err_t hook_chain_add(hook_chain_t *chain, void *before, void *after, void *udata)
+{
+    return hook_chain_add_priority(chain, before, after, udata, HOOK_CHAIN_PRIORITY_DEFAULT);
 }
 KP_EXPORT_SYMBOL(hook_chain_add);
 
 void hook_chain_remove(hook_chain_t *chain, void *before, void *after)
 {
-    for (int i = 0; i < HOOK_CHAIN_NUM; i++) {
-        if (chain->states[i] == CHAIN_ITEM_STATE_READY)
-            if ((before && chain->befores[i] == before) || (after && chain->afters[i] == after)) {
-                chain->states[i] = CHAIN_ITEM_STATE_BUSY;
-                dsb(ish);
-                chain->udata[i] = 0;
-                chain->befores[i] = 0;
-                chain->afters[i] = 0;
-                dsb(ish);
-                chain->states[i] = CHAIN_ITEM_STATE_EMPTY;
-                break;
-            }
-    }
-    logkv("Wrap chain remove: %llx, %llx, %llx\n", chain->hook.func_addr, before, after);
+    hook_lock();
+    chain_remove(chain, before, after);
+    hook_unlock();
 }
 KP_EXPORT_SYMBOL(hook_chain_remove);
 
-// todo: lock
-hook_err_t hook_wrap(void *func, int32_t argno, void *before, void *after, void *udata)
+static hook_err_t wrap_chain_locked(void *func, int32_t argno, void *before, void *after, void *udata,
+                                    int32_t priority, uint32_t flags, const hook_caller_range_t *callers,
+                                    int32_t caller_num)
 {
-    if (is_bad_address(func)) return -HOOK_BAD_ADDRESS;
     uint64_t faddr = (uint64_t)func;
     uint64_t origin = branch_func_addr(faddr);
     if (is_bad_address(func)) return -HOOK_BAD_ADDRESS;
     hook_chain_t *chain = (hook_chain_t *)hook_get_mem_from_origin(origin);
-    if (chain) return hook_chain_add(chain, before, after, udata);
+    if (chain) {
+        chain->flags |= flags;
+        return chain_add(chain, before, after, udata, priority, callers, caller_num);
+    }
     chain = (hook_chain_t *)hook_mem_zalloc(origin, INLINE_CHAIN);
     if (!chain) return -HOOK_NO_MEM;
-    chain->chain_items_max = 0;
+    chain->flags = flags;
+    hook_err_t err = -HOOK_NO_MEM;
     hook_t *hook = &chain->hook;
+    hook_transit_t *transit = (hook_transit_t *)hook_mem_class_zalloc(HOOK_MEM_TRANSIT);
+    if (!transit) goto err;
+    chain->transit = transit;
+    hook_chain_items_init(&chain->items);
+    transit->chain = chain;
+    transit->stack = &hook_stack;
     hook->func_addr = faddr;
     hook->origin_addr = origin;
-    hook->replace_addr = (uint64_t)chain->transit;
+    hook->replace_addr = (uint64_t)transit->insts;
     hook->relo_addr = (uint64_t)hook->relo_insts;
     logkv("Wrap func: %llx, origin: %llx, replace: %llx, relocate: %llx, chain: %llx\n", hook->func_addr,
           hook->origin_addr, hook->replace_addr, hook->relo_addr, chain);
-    hook_err_t err = hook_prepare(hook);
+    err = hook_prepare(hook);
     if (err) goto err;
-    err = hook_chain_prepare(chain->transit, argno);
+    err = hook_chain_prepare(transit->insts, argno);
     if (err) goto err;
-    err = hook_chain_add(chain, before, after, udata);
+    err = chain_add(chain, before, after, udata, priority, callers, caller_num);
     if (err) goto err;
     hook_chain_install(chain);
-    logkv("Wrap func: %llx succsseed\n", hook->func_addr);
+    logkv("Wrap func: %llx succsseed\n", faddr);
     return HOOK_NO_ERR;
 err:
+    // never installed, no reader
+    hook_chain_items_release(&chain->items, &chain->retired);
+    hook_mem_free(transit);
     hook_mem_free(chain);
-    logkv("Wrap func: %llx failed, err: %d\n", hook->func_addr, err);
+    logkv("Wrap func: %llx failed, err: %d\n", faddr, err);
+    return err;
+}
+
+static hook_err_t wrap_chain(void *func, int32_t argno, void *before, void *after, void *udata, int32_t priority,
+                             uint32_t flags, const hook_caller_range_t *callers, int32_t caller_num)
+{
+    if (is_bad_address(func)) return -HOOK_BAD_ADDRESS;
+    hook_lock();
+    hook_err_t err = wrap_chain_locked(func, argno, before, after, udata, priority, flags, callers, caller_num);
+    hook_unlock();
     return err;
 }
+
+hook_err_t hook_wrap_flags(void *func, int32_t argno, void *before, void *after, void *udata, int32_t priority,
+                           uint32_t flags)
+{
+    return wrap_chain(func, argno, before, after, udata, priority, flags, 0, 0);
+}
+KP_EXPORT_SYMBOL(hook_wrap_flags);
+
+hook_err_t hook_wrap_callers(void *func, int32_t argno, void *before, void *after, void *udata, int32_t priority,
+                             const hook_caller_range_t *callers, int32_t caller_num)
+{
+    return wrap_chain(func, argno, before, after, udata, priority, 0, callers, caller_num);
+}
+KP_EXPORT_SYMBOL(hook_wrap_callers);
+
+hook_err_t hook_wrap_priority(void *func, int32_t argno, void *before, void *after, void *udata, int32_t priority)
+{
+    return hook_wrap_flags(func, argno, before, after, udata, priority, 0);
+}
+KP_EXPORT_SYMBOL(hook_wrap_priority);
+
+hook_err_t hook_wrap(void *func, int32_t argno, void *before, void *after, void *udata)
+{
+    return hook_wrap_priority(func, argno, before, after, udata, HOOK_CHAIN_PRIORITY_DEFAULT);
+}
 KP_EXPORT_SYMBOL(hook_wrap);
 
 void hook_unwrap_remove(void *func, void *before, void *after, int remove)
@@ -797,17 +1004,375 @@ void hook_unwrap_remove(void *func, void *before, void *after, int remove)
     uint64_t faddr = (uint64_t)func;
     uint64_t origin = branch_func_addr(faddr);
     if (is_bad_address(func)) return;
+    hook_lock();
     hook_chain_t *chain = (hook_chain_t *)hook_get_mem_from_origin(origin);
-    if (!chain) return;
-    hook_chain_remove(chain, before, after);
-    if (!remove) return;
-    // todo:
-    for (int i = 0; i < HOOK_CHAIN_NUM; i++) {
-        if (chain->states[i] != CHAIN_ITEM_STATE_EMPTY) return;
-    }
+    if (!chain) goto out;
+    int32_t remain = chain_remove(chain, before, after);
+    if (!remove || remain) goto out;
     hook_chain_uninstall(chain);
-    // todo: unsafe
-    hook_mem_free(chain);
+    // a caller can still run in the transit, freed by hook_reclaim
+    hook_chain_kill(chain);
     logkv("Unwrap func: %llx\n", func);
+out:
+    hook_unlock();
 }
 KP_EXPORT_SYMBOL(hook_unwrap_remove);
+
+static hook_t *hook_of_func(void *func)
+{
+    uint64_t origin = branch_func_addr((uint64_t)func);
+    void *mem = hook_get_mem_from_origin(origin);
+    if (!mem) return 0;
+    switch (hook_mem_type(mem)) {
+    case INLINE:
+        return (hook_t *)mem;
+    case INLINE_CHAIN:
+        return &((hook_chain_t *)mem)->hook;
+    default:
+        return 0;
+    }
+}
+
+// The caller flushes the icache, so a batch of patches needs only one flush.
+static void hook_patch_text_nosync(uint64_t va, const uint32_t *insts, int32_t num)
+{
+    uint64_t *entry = pgtable_entry_kernel(va);
+    uint64_t ori_prot = *entry;
+    modify_entry_kernel(va, entry, (ori_prot | PTE_DBM) & ~PTE_RDONLY);
+    for (int32_t i = 0; i < num; i++) {
+        *((uint32_t *)va + i) = insts[i];
+    }
+    dsb(ish);
+    modify_entry_kernel(va, entry, ori_prot);
+}
+
+static void hook_patch_text(uint64_t va, const uint32_t *insts, int32_t num)
+{
+    hook_patch_text_nosync(va, insts, num);
+    flush_icache_all();
+}
+
+hook_err_t hook_disarm(void *func)
+{
+    if (is_bad_address(func)) return -HOOK_BAD_ADDRESS;
+    hook_lock();
+    hook_t *hook = hook_of_func(func);
+    if (!hook) {
+        hook_unlock();
+        return -HOOK_NOT_FOUND;
+    }
+    uint32_t *origin = (uint32_t *)hook->origin_addr;
+    if (*origin == hook->origin_insts[0]) {
+        hook_unlock();
+        return HOOK_NO_ERR;
+    }
+    // the first instruction goes first, then nothing can enter the rest of the trampoline
+    hook_patch_text(hook->origin_addr, hook->origin_insts, 1);
+    if (hook->tramp_insts_num > 1)
+        hook_patch_text(hook->origin_addr + 4, hook->origin_insts + 1, hook->tramp_insts_num - 1);
+    hook_unlock();
+    logkv("Disarm func: %llx\n", func);
+    return HOOK_NO_ERR;
+}
+KP_EXPORT_SYMBOL(hook_disarm);
+
+hook_err_t hook_arm(void *func)
+{
+    if (is_bad_address(func)) return -HOOK_BAD_ADDRESS;
+    hook_lock();
+    hook_t *hook = hook_of_func(func);
+    if (!hook) {
+        hook_unlock();
+        return -HOOK_NOT_FOUND;
+    }
+    uint32_t *origin = (uint32_t *)hook->origin_addr;
+    if (*origin == hook->tramp_insts[0]) {
+        hook_unlock();
+        return HOOK_NO_ERR;
+    }
+    // the tail first, the trampoline is only reachable once the first instruction is written
+    if (hook->tramp_insts_num > 1)
+        hook_patch_text(hook->origin_addr + 4, hook->tramp_insts + 1, hook->tramp_insts_num - 1);
+    hook_patch_text(hook->origin_addr, hook->tramp_insts, 1);
+    hook_unlock();
+    logkv("Arm func: %llx\n", func);
+    return HOOK_NO_ERR;
+}
+KP_EXPORT_SYMBOL(hook_arm);
+
+typedef struct
+{
+    int (*fn)(const hook_entry_t *entry, void *udata);
+    void *udata;
+} hook_visit_t;
+
+static int hook_visit(void *mem, enum hook_type type, void *udata)
+{
+    hook_visit_t *visit = (hook_visit_t *)udata;
+    hook_entry_t entry = { .type = type };
+    if (type == INLINE) {
+        hook_t *hook = (hook_t *)mem;
+        entry.origin = hook->origin_addr;
+        entry.replace = hook->replace_addr;
+    } else if (type == INLINE_CHAIN) {
+        hook_chain_t *chain = (hook_chain_t *)mem;
+        entry.flags = chain->flags;
+        entry.origin = chain->hook.origin_addr;
+        entry.replace = chain->hook.replace_addr;
+        entry.calls = chain->calls;
+        entry.items = chain->items;
+    } else if (type == FUNCTION_POINTER_CHAIN) {
+        fp_hook_chain_t *chain = (fp_hook_chain_t *)mem;
+        entry.flags = chain->flags;
+        entry.origin = chain->hook.fp_addr;
+        entry.replace = chain->hook.replace_addr;
+        entry.calls = chain->calls;
+        entry.items = chain->items;
+    } else {
+        return 0;
+    }
+    return visit->fn(&entry, visit->udata);
+}
+
+void hook_for_each(int (*fn)(const hook_entry_t *entry, void *udata), void *udata)
+{
+    hook_visit_t visit = { fn, udata };
+    hook_lock();
+    hook_mem_for_each(hook_visit, &visit);
+    hook_unlock();
+}
+KP_EXPORT_SYMBOL(hook_for_each);
+
+void hook_set_owner_fn(void *(*owner)(void))
+{
+    hook_chain_items_set_owner(owner);
+}
+KP_EXPORT_SYMBOL(hook_set_owner_fn);
+
+typedef struct
+{
+    hook_chain_items_t **items;
+    hook_chain_items_t **retired;
+    hook_readers_t *readers;
+    hook_transit_t *transit;
+} chain_ref_t;
+
+static int chain_ref(void *mem, enum hook_type type, chain_ref_t *ref)
+{
+    if (type == INLINE_CHAIN) {
+        hook_chain_t *chain = (hook_chain_t *)mem;
+        *ref = (chain_ref_t){ &chain->items, &chain->retired, &chain->readers, chain->transit };
+        return 1;
+    }
+    if (type == FUNCTION_POINTER_CHAIN) {
+        fp_hook_chain_t *chain = (fp_hook_chain_t *)mem;
+        *ref = (chain_ref_t){ &chain->items, &chain->retired, &chain->readers, chain->transit };
+        return 1;
+    }
+    return 0;
+}
+
+typedef struct
+{
+    void *owner;
+    uint32_t gen;
+    int32_t busy;
+    int32_t kept;
+} reclaim_t;
+
+// Whether the replaced arrays, and the current one of a dying chain, hold items the caller waits for.
+static int32_t chain_holds(chain_ref_t *ref, void *owner, int32_t dying)
+{
+    if (!owner) return 1;
+    if (dying && hook_chain_items_owned(*ref->items, owner)) return 1;
+    for (hook_chain_items_t *items = *ref->retired; items; items = items->next) {
+        if (hook_chain_items_owned(items, owner)) return 1;
+    }
+    return 0;
+}
+
+static int reclaim_retired(void *mem, enum hook_type type, void *udata)
+{
+    reclaim_t *rec = (reclaim_t *)udata;
+    chain_ref_t ref;
+    if (!chain_ref(mem, type, &ref) || !*ref.retired) return 0;
+    // the calling task is one of the readers, it can not wait for itself
+    if (hook_transit_nested(ref.transit)) return 0;
+    int32_t holds = chain_holds(&ref, rec->owner, 0);
+    if (hook_chain_items_reclaim(ref.retired, ref.readers) && holds) rec->busy++;
+    return 0;
+}
+
+static int count_kept(void *mem, enum hook_type type, void *udata)
+{
+    reclaim_t *rec = (reclaim_t *)udata;
+    chain_ref_t ref;
+    if (chain_ref(mem, type, &ref) && *ref.retired && chain_holds(&ref, rec->owner, 0)) rec->kept++;
+    return 0;
+}
+
+static int dying_busy(void *mem, enum hook_type type, void *udata)
+{
+    reclaim_t *rec = (reclaim_t *)udata;
+    chain_ref_t ref;
+    if (hook_mem_dying(mem) > rec->gen || !chain_ref(mem, type, &ref)) return 0;
+    if (hook_transit_nested(ref.transit) || !chain_holds(&ref, rec->owner, 1)) return 0;
+    if (*(volatile int32_t *)&ref.readers->count[0] || *(volatile int32_t *)&ref.readers->count[1]) rec->busy++;
+    return 0;
+}
+
+static int dying_free(void *mem, enum hook_type type, void *udata)
+{
+    reclaim_t *rec = (reclaim_t *)udata;
+    chain_ref_t ref;
+    if (hook_mem_dying(mem) > rec->gen || !chain_ref(mem, type, &ref)) return 0;
+    if (hook_transit_nested(ref.transit) || ref.readers->count[0] || ref.readers->count[1]) {
+        if (chain_holds(&ref, rec->owner, 1)) rec->kept++;
+        return 0;
+    }
+    hook_chain_items_release(ref.items, ref.retired);
+    hook_mem_free(ref.transit);
+    hook_mem_free(mem);
+    return 0;
+}
+
+static void reclaim_relax()
+{
+    if (wait_relax) {
+        wait_relax();
+    } else {
+        asm volatile("yield");
+    }
+}
+
+// A reader that never returns, e.g. a callback that exits the task, leaves a count that never drains,
+// such arrays and chains are kept after this many relaxes.
+#define HOOK_RECLAIM_RELAX_MAX 1000
+
+int32_t hook_reclaim(void *owner)
+{
+    reclaim_t rec = { .owner = owner };
+    int32_t relax = 0;
+
+    // replaced arrays of chains in use, each pass moves the drained reader counters on
+    do {
+        rec.busy = 0;
+        hook_lock();
+        hook_mem_for_each(reclaim_retired, &rec);
+        hook_unlock();
+        if (rec.busy) reclaim_relax();
+    } while (rec.busy && ++relax < HOOK_RECLAIM_RELAX_MAX);
+
+    // unwrapped chains take no new reader, wait for the counted ones
+    hook_lock();
+    rec.gen = dying_gen++;
+    hook_unlock();
+    do {
+        rec.busy = 0;
+        hook_lock();
+        hook_mem_for_each_dying(dying_busy, &rec);
+        hook_unlock();
+        if (rec.busy) reclaim_relax();
+    } while (rec.busy && ++relax < HOOK_RECLAIM_RELAX_MAX);
+    if (rec.busy) logkfw("readers of owner %llx did not return, keep their chains\n", owner);
+
+    // then for the ones not counted yet or any more
+    if (wait_sync) wait_sync();
+
+    hook_lock();
+    hook_mem_for_each_dying(dying_free, &rec);
+    clones_free(rec.gen);
+    hook_mem_for_each(count_kept, &rec);
+    hook_unlock();
+    if (rec.kept) logkfw("Reclaim owner: %llx, kept: %d\n", owner, rec.kept);
+    return rec.kept;
+}
+KP_EXPORT_SYMBOL(hook_reclaim);
+
+typedef struct
+{
+    void *owner;
+    int32_t cap;
+    uintptr_t *fp_addrs;
+    void **fp_origins;
+    int32_t fp_num;
+    int32_t removed;
+    int32_t chains;
+    int32_t left;
+} owner_release_t;
+
+static int count_owned(void *mem, enum hook_type type, void *udata)
+{
+    owner_release_t *rel = (owner_release_t *)udata;
+    chain_ref_t ref;
+    if (type == FUNCTION_POINTER_CHAIN && chain_ref(mem, type, &ref) && hook_chain_items_owned(*ref.items, rel->owner))
+        rel->cap++;
+    return 0;
+}
+
+static int count_left(void *mem, enum hook_type type, void *udata)
+{
+    owner_release_t *rel = (owner_release_t *)udata;
+    chain_ref_t ref;
+    if (chain_ref(mem, type, &ref)) rel->left += hook_chain_items_owned(*ref.items, rel->owner);
+    return 0;
+}
+
+static int detach_owned(void *mem, enum hook_type type, void *udata)
+{
+    owner_release_t *rel = (owner_release_t *)udata;
+    chain_ref_t ref;
+    if (!chain_ref(mem, type, &ref)) return 0;
+    int32_t owned = hook_chain_items_owned(*ref.items, rel->owner);
+    if (!owned) return 0;
+    hook_chain_items_remove_owner(ref.items, ref.retired, ref.readers, rel->owner);
+    // no memory for the new array, the items stay
+    if (hook_chain_items_owned(*ref.items, rel->owner)) return 0;
+    rel->removed += owned;
+    rel->chains++;
+    if ((*ref.items)->num) return 0;
+
+    if (type == INLINE_CHAIN) {
+        hook_t *hook = &((hook_chain_t *)mem)->hook;
+        hook_patch_text_nosync(hook->origin_addr, hook->origin_insts, hook->tramp_insts_num);
+    } else {
+        fp_hook_chain_t *chain = (fp_hook_chain_t *)mem;
+        if (*(uint64_t *)chain->hook.fp_addr == chain->hook.replace_addr) {
+            // without memory for the batch the chain stays installed and empty
+            if (rel->fp_num >= rel->cap) return 0;
+            rel->fp_addrs[rel->fp_num] = chain->hook.fp_addr;
+            rel->fp_origins[rel->fp_num++] = (void *)chain->hook.origin_fp;
+        }
+    }
+    hook_chain_kill(mem);
+    return 0;
+}
+
+int32_t hook_release_owner(void *owner)
+{
+    if (!owner) return 0;
+    owner_release_t rel = { .owner = owner };
+    hook_lock();
+    hook_mem_for_each(count_owned, &rel);
+    if (rel.cap) {
+        rel.fp_addrs = (uintptr_t *)kp_malloc(rel.cap * (sizeof(uintptr_t) + sizeof(void *)));
+        if (!rel.fp_addrs) rel.cap = 0;
+        rel.fp_origins = (void **)(rel.fp_addrs + rel.cap);
+    }
+
+    // unpublish every item and inline trampoline first, then a single icache maintenance
+    hook_mem_for_each(detach_owned, &rel);
+    if (rel.fp_num) fp_hook_batch(rel.fp_addrs, rel.fp_origins, 0, rel.fp_num);
+    flush_icache_all();
+    // items whose chain had no memory for a new array
+    hook_mem_for_each(count_left, &rel);
+    hook_unlock();
+    if (rel.fp_addrs) kp_free(rel.fp_addrs);
+
+    // one wait covers all chains
+    int32_t kept = hook_reclaim(owner);
+    logkv("Release owner: %llx, items: %d, chains: %d, left: %d, kept: %d\n", owner, rel.removed, rel.chains, rel.left,
+          kept);
+    return rel.left + kept;
+}
+KP_EXPORT_SYMBOL(hook_release_owner);
@@ -18,6 +18,7 @@
 #include "start.h"
 #include "hook.h"
 #include "tlsf.h"
+#include <kplock.h>
 #include "hmem.h"
 #include "setup.h"
 
@@ -94,9 +95,14 @@ uint64_t pgd_va;
 // int64_t pa_bits = 0;
 
 uint64_t kernel_stext_va = 0;
+uint64_t kernel_etext_va = 0;
+
+int64_t kp_exec_text_distance = 0;
+KP_EXPORT_SYMBOL(kp_exec_text_distance);
 
 tlsf_t kp_rw_mem = 0;
 tlsf_t kp_rox_mem = 0;
+kp_lock_t kp_mem_lock = KP_LOCK_INIT;
 
 #define BOOT_LOG_SIZE 0x2000
 static char boot_log[BOOT_LOG_SIZE] = { 0 };
@@ -263,8 +269,12 @@ static void prot_myself()
     flush_tlb_kernel_range(_kp_hook_start, _kp_hook_end);
     hook_mem_add(_kp_hook_start, HOOK_ALLOC_SIZE);
 
+    // rox right after hook, both as close to kernel text as the loaded image allows
+    _kp_rox_start = _kp_hook_end;
+    _kp_rox_end = _kp_rox_start + MEMORY_ROX_SIZE;
+
     // rw memory
-    _kp_rw_start = _kp_hook_end;
+    _kp_rw_start = _kp_rox_end;
     _kp_rw_end = _kp_rw_start + MEMORY_RW_SIZE;
     log_boot("RW: %llx, %llx\n", _kp_rw_start, _kp_rw_end);
 
@@ -282,8 +292,6 @@ static void prot_myself()
     kp_rox_mem = tlsf_malloc(kp_rw_mem, tlsf_size());
     tlsf_create(kp_rox_mem);
 
-    _kp_rox_start = _kp_rw_end;
-    _kp_rox_end = _kp_rox_start + MEMORY_ROX_SIZE;
     log_boot("ROX: %llx, %llx\n", _kp_rox_start, _kp_rox_end);
 
     tlsf_add_pool(kp_rox_mem, (void *)_kp_rox_start, MEMORY_ROX_SIZE);
@@ -299,6 +307,14 @@ static void prot_myself()
     }
     flush_tlb_kernel_range(_kp_rox_start, _kp_rox_end);
 
+    // farthest distance between kernel text and hook or kpm text
+    uint64_t ktext_start = kernel_stext_va ?: kernel_va;
+    uint64_t ktext_end = kernel_etext_va ?: kernel_va + kernel_size;
+    uint64_t exec_start = _kp_hook_start < ktext_start ? _kp_hook_start : ktext_start;
+    uint64_t exec_end = _kp_rox_end > ktext_end ? _kp_rox_end : ktext_end;
+    kp_exec_text_distance = exec_end - exec_start;
+    log_boot("Exec text distance: %llx, near: %d\n", kp_exec_text_distance, is_kp_exec_near_text());
+
     // add to vmalloc area
     void (*vm_area_add_early)(struct vm_struct *vm) =
         (typeof(vm_area_add_early))kallsyms_lookup_name("vm_area_add_early");
@@ -406,6 +422,7 @@ static void start_init(uint64_t kimage_voff, uint64_t linear_voff)
     uint64_t kallsym_addr = kernel_va + start_preset.kallsyms_lookup_name_offset;
     kallsyms_lookup_name = (typeof(kallsyms_lookup_name))(kallsym_addr);
     kernel_stext_va = kallsyms_lookup_name("_stext");
+    kernel_etext_va = kallsyms_lookup_name("_etext");
     printk = (typeof(printk))kallsyms_lookup_name("printk");
     if (!printk) printk = (typeof(printk))kallsyms_lookup_name("_printk");
 
@@ -39,18 +39,42 @@ int local_strcmp(const char *s1, const char *s2)
     return d;
 }
 
+// symbols are sorted by hash in symbol_init
 unsigned long symbol_lookup_name(const char *name)
 {
     unsigned long hash = sym_hash(name);
-    for (uint64_t addr = symbol_start; addr < symbol_end; addr += sizeof(kp_symbol_t)) {
-        kp_symbol_t *symbol = (kp_symbol_t *)addr;
-        if (hash == symbol->hash && !local_strcmp(name, symbol->name)) {
-            return symbol->addr;
+    kp_symbol_t *symbols = (kp_symbol_t *)symbol_start;
+    uint64_t lo = 0, hi = (symbol_end - symbol_start) / sizeof(kp_symbol_t);
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (symbols[mid].hash < hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
     }
+    for (kp_symbol_t *symbol = symbols + lo; (uint64_t)symbol < symbol_end && symbol->hash == hash; symbol++) {
+        if (!local_strcmp(name, symbol->name)) return symbol->addr;
+    }
     return 0;
 }
 
+static void symbol_sort()
+{
+    kp_symbol_t *symbols = (kp_symbol_t *)symbol_start;
+    uint64_t num = (symbol_end - symbol_start) / sizeof(kp_symbol_t);
+    kp_symbol_t tmp;
+    for (uint64_t i = 1; i < num; i++) {
+        if (symbols[i - 1].hash <= symbols[i].hash) continue;
+        __builtin_memcpy(&tmp, &symbols[i], sizeof(kp_symbol_t));
+        uint64_t j = i;
+        for (; j > 0 && symbols[j - 1].hash > tmp.hash; j--) {
+            __builtin_memcpy(&symbols[j], &symbols[j - 1], sizeof(kp_symbol_t));
+        }
+        __builtin_memcpy(&symbols[j], &tmp, sizeof(kp_symbol_t));
+    }
+}
+
 void symbol_init()
 {
     symbol_start = (uint64_t)_kp_symbol_start;
@@ -61,4 +85,5 @@ void symbol_init()
         symbol->addr = symbol->addr - link_base_addr + runtime_base_addr;
         symbol->hash = sym_hash(symbol->name);
     }
+    symbol_sort();
 }
\ No newline at end of file
@@ -44,6 +44,17 @@ extern uint64_t _kp_rw_end;
 extern uint64_t _kp_region_start;
 extern uint64_t _kp_region_end;
 
+// span covering kernel text, hook and kpm rox memory
+extern int64_t kp_exec_text_distance;
+
+// B and BL reach +-128M
+#define KP_BRANCH_RANGE (128 << 20)
+
+static inline bool is_kp_exec_near_text()
+{
+    return kp_exec_text_distance > 0 && kp_exec_text_distance < KP_BRANCH_RANGE;
+}
+
 static inline bool is_kp_text_area(unsigned long addr)
 {
     return addr >= (unsigned long)_kp_text_start && addr < (unsigned long)_kp_text_end;
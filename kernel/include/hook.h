@@ -20,6 +20,8 @@ typedef enum
     HOOK_BAD_RELO = 4092,
     HOOK_TRANSIT_NO_MEM = 4091,
     HOOK_CHAIN_FULL = 4090,
+    HOOK_NOT_FOUND = 4089,
+    HOOK_SLOT_CHANGED = 4088,
 } hook_err_t;
 
 enum hook_type
@@ -30,12 +32,6 @@ enum hook_type
     FUNCTION_POINTER_CHAIN,
 };
 
-typedef int8_t chain_item_state;
-
-#define CHAIN_ITEM_STATE_EMPTY 0
-#define CHAIN_ITEM_STATE_READY 1
-#define CHAIN_ITEM_STATE_BUSY 2
-
 #define local_offsetof(TYPE, MEMBER) ((size_t) & ((TYPE *)0)->MEMBER)
 #define local_container_of(ptr, type, member) ({ (type *)((char *)(ptr) - local_offsetof(type, member)); })
 
@@ -43,10 +39,15 @@ typedef int8_t chain_item_state;
 #define TRAMPOLINE_NUM 4
 #define RELOCATE_INST_NUM (TRAMPOLINE_NUM * 8 + 8)
 
-#define HOOK_CHAIN_NUM 0x10
-#define TRANSIT_INST_NUM 0x60
+#define TRANSIT_INST_NUM 0x100
+
+#define HOOK_CHAIN_PRIORITY_DEFAULT 0
 
-#define FP_HOOK_CHAIN_NUM 0x20
+// chain flags
+// a call of the chain nested inside its own callbacks or origin goes straight to the origin
+#define HOOK_CHAIN_NO_REENTRY 0x1
+// count calls into the chain, not atomic, an estimate under concurrency
+#define HOOK_CHAIN_COUNT_CALLS 0x2
 
 #define ARM64_NOP 0xd503201f
 #define ARM64_BTI_C 0xd503245f
@@ -201,16 +202,73 @@ typedef void (*hook_chain10_callback)(hook_fargs10_t *fargs, void *udata);
 typedef void (*hook_chain11_callback)(hook_fargs11_t *fargs, void *udata);
 typedef void (*hook_chain12_callback)(hook_fargs12_t *fargs, void *udata);
 
+// The kernel stack of the running task, for the frame record walk of hook_transit_nested.
+typedef struct
+{
+    int32_t task_offset; // of the stack pointer in task_struct, -1 if unknown or sp_el0 is not the task
+    int32_t size; // THREAD_SIZE, stacks are aligned to it
+} hook_stack_t;
+
+typedef struct
+{
+    void *chain;
+    const hook_stack_t *stack;
+    uint32_t insts[TRANSIT_INST_NUM];
+} hook_transit_t __attribute__((aligned(8)));
+
+#define HOOK_CALLER_RANGE_NUM 4
+// a chain with caller filtered items holds at most this many items, one bit each in the transit
+#define HOOK_CALLER_CHAIN_MAX 64
+
+// [start, end) of the caller return addresses a callback is interested in
+typedef struct
+{
+    uint64_t start;
+    uint64_t end;
+} hook_caller_range_t;
+
+typedef struct
+{
+    int32_t priority;
+    int32_t caller_num; // 0 for any caller
+    void *udata;
+    void *before;
+    void *after;
+    void *owner;
+    hook_caller_range_t callers[HOOK_CALLER_RANGE_NUM];
+} hook_chain_item_t;
+
+// Immutable once published, sorted by descending priority.
+typedef struct _hook_chain_items
+{
+    int32_t num;
+    int32_t filtered; // number of items with caller ranges
+    uint32_t seq; // readers seq when it was replaced
+    struct _hook_chain_items *next; // next replaced array
+    hook_chain_item_t items[0];
+} hook_chain_items_t __attribute__((aligned(8)));
+
+// Tasks running in a transit, counted from before the items are loaded until the afters are done,
+// so a task sleeping in the origin still holds its items.
+// New readers count in count[idx], a writer moves idx once the other counter is empty and bumps seq.
+// An array replaced at seq s has no reader left at seq s + 2, see hook_chain_items_reclaim.
+typedef struct
+{
+    uint32_t idx;
+    uint32_t seq;
+    int32_t count[2];
+} hook_readers_t;
+
+// hook stays the first member, prebuilt modules read chain->hook inline, e.g. wrap_get_origin_func
 typedef struct _hook_chain
 {
-    // must be the first element
     hook_t hook;
-    int32_t chain_items_max;
-    chain_item_state states[HOOK_CHAIN_NUM];
-    void *udata[HOOK_CHAIN_NUM];
-    void *befores[HOOK_CHAIN_NUM];
-    void *afters[HOOK_CHAIN_NUM];
-    uint32_t transit[TRANSIT_INST_NUM];
+    hook_transit_t *transit;
+    hook_chain_items_t *items;
+    hook_chain_items_t *retired;
+    hook_readers_t readers;
+    uint32_t flags;
+    uint64_t calls;
 } hook_chain_t __attribute__((aligned(8)));
 
 typedef struct
@@ -223,14 +281,136 @@ typedef struct
 typedef struct _fphook_chain
 {
     fp_hook_t hook;
-    int32_t chain_items_max;
-    chain_item_state states[FP_HOOK_CHAIN_NUM];
-    void *udata[FP_HOOK_CHAIN_NUM];
-    void *befores[FP_HOOK_CHAIN_NUM];
-    void *afters[FP_HOOK_CHAIN_NUM];
-    uint32_t transit[TRANSIT_INST_NUM];
+    hook_transit_t *transit;
+    hook_chain_items_t *items;
+    hook_chain_items_t *retired;
+    hook_readers_t readers;
+    uint32_t flags;
+    uint64_t calls;
 } fp_hook_chain_t __attribute__((aligned(8)));
 
+// A snapshot of one installed hook or chain, see hook_for_each.
+typedef struct
+{
+    enum hook_type type;
+    uint32_t flags;
+    uint64_t origin; // hooked function, or function pointer address
+    uint64_t replace; // replace function, or transit of a chain
+    uint64_t calls;
+    hook_chain_items_t *items; // 0 for plain hooks
+} hook_entry_t;
+
+// A private copy of an ops table installed on one object, e.g. file->f_op.
+typedef struct
+{
+    void **slot;
+    void *origin_ops;
+    int32_t ops_size;
+    uint32_t dying; // hook_reclaim generation when restored
+    void *next; // restored clones not freed yet
+    uint64_t ops[0];
+} fp_ops_clone_t __attribute__((aligned(8)));
+
+/**
+ * @brief Whether the running transit is nested in a call made from the same transit,
+ * by looking for a return address inside it in the frame record chain of the current stack.
+ * Stateless, so a callback that never returns leaves nothing behind.
+ * Inlined into the transit, which is copied and can not call out.
+ * 
+ * Best effort: the walk is bounded by the task stack, task_stack_page(current) + THREAD_SIZE, or by the
+ * THREAD_SIZE aligned irq or overflow stack sp is on. A call entering on another stack, e.g. from an irq
+ * taken inside a callback, is not seen as nested. Neither is one below code built without frame records.
+ */
+static inline __attribute__((always_inline)) int hook_transit_nested(hook_transit_t *transit)
+{
+    const hook_stack_t *stack = transit->stack;
+    if (!stack || stack->size <= 0) return 0;
+    uint64_t start = (uint64_t)transit->insts;
+    uint64_t end = start + sizeof(transit->insts);
+    uint64_t fp, sp, base = 0;
+    asm volatile("mov %0, x29" : "=r"(fp));
+    asm volatile("mov %0, sp" : "=r"(sp));
+    if (stack->task_offset >= 0) {
+        uint64_t task;
+        asm volatile("mrs %0, sp_el0" : "=r"(task));
+        base = *(uint64_t *)(task + stack->task_offset);
+    }
+    if (sp < base || sp >= base + stack->size) base = sp & ~(uint64_t)(stack->size - 1);
+    uint64_t top = base + stack->size;
+    // records move strictly up within [sp, top), the walk ends there
+    while (fp >= sp && fp + 16 <= top && !(fp & 7)) {
+        register uint64_t lr asm("x30") = ((uint64_t *)fp)[1];
+        // xpaclri, strip the pointer authentication code, nop without pauth
+        asm volatile("hint #7" : "+r"(lr));
+        if (lr >= start && lr < end) return 1;
+        uint64_t next = ((uint64_t *)fp)[0];
+        if (next <= fp) break;
+        fp = next;
+    }
+    return 0;
+}
+
+/**
+ * @brief Count the running task as a reader of the chain, full barrier before the items are loaded.
+ * Inlined into the transit, like hook_transit_nested.
+ * 
+ * @return uint32_t counter index to pass to hook_readers_exit
+ */
+static inline __attribute__((always_inline)) uint32_t hook_readers_enter(hook_readers_t *readers)
+{
+    uint32_t idx = *(volatile uint32_t *)&readers->idx & 1;
+    int32_t val;
+    uint32_t tmp;
+    asm volatile("1:	ldxr	%w0, %2\n"
+                 "	add	%w0, %w0, #1\n"
+                 "	stxr	%w1, %w0, %2\n"
+                 "	cbnz	%w1, 1b\n"
+                 "	dmb	ish"
+                 : "=&r"(val), "=&r"(tmp), "+Q"(readers->count[idx])
+                 :
+                 : "memory");
+    return idx;
+}
+
+static inline __attribute__((always_inline)) void hook_readers_exit(hook_readers_t *readers, uint32_t idx)
+{
+    int32_t val;
+    uint32_t tmp;
+    asm volatile("	dmb	ish\n"
+                 "1:	ldxr	%w0, %2\n"
+                 "	sub	%w0, %w0, #1\n"
+                 "	stxr	%w1, %w0, %2\n"
+                 "	cbnz	%w1, 1b"
+                 : "=&r"(val), "=&r"(tmp), "+Q"(readers->count[idx])
+                 :
+                 : "memory");
+}
+
+/**
+ * @brief Bit i is set if item i has caller ranges and lr is in none of them,
+ * all is set if every item is skipped. Inlined into the transit, like hook_transit_nested.
+ */
+static inline __attribute__((always_inline)) uint64_t hook_items_caller_skip(const hook_chain_items_t *items,
+                                                                             uint64_t lr, int *all)
+{
+    uint64_t skip = 0;
+    int32_t run = 0;
+    for (int32_t i = 0; i < items->num; i++) {
+        const hook_chain_item_t *item = &items->items[i];
+        int32_t match = !item->caller_num;
+        for (int32_t j = 0; j < item->caller_num; j++) {
+            if (lr >= item->callers[j].start && lr < item->callers[j].end) match = 1;
+        }
+        if (match) {
+            run++;
+        } else {
+            skip |= 1ull << i;
+        }
+    }
+    *all = !run;
+    return skip;
+}
+
 static inline int is_bad_address(void *addr)
 {
     return ((uint64_t)addr & 0x8000000000000000) != 0x8000000000000000;
@@ -262,7 +442,7 @@ void hook_uninstall(hook_t *hook);
 hook_err_t hook(void *func, void *replace, void **backup);
 
 /**
- * @brief unhook of hooked function
+ * @brief unhook of hooked function, a function wrapped by hook_wrap is left alone
  * 
  * @param func 
  */
@@ -278,6 +458,19 @@ void unhook(void *func);
  * @return hook_err_t 
  */
 hook_err_t hook_chain_add(hook_chain_t *chain, void *before, void *after, void *udata);
+
+/**
+ * @brief Add before and after to chain, higher priority befores run earlier and afters run later.
+ * Items of equal priority keep their registration order.
+ * 
+ * @param chain 
+ * @param before 
+ * @param after 
+ * @param udata 
+ * @param priority 
+ * @return hook_err_t 
+ */
+hook_err_t hook_chain_add_priority(hook_chain_t *chain, void *before, void *after, void *udata, int32_t priority);
 /**
  * @brief 
  * 
@@ -304,6 +497,59 @@ void hook_chain_remove(hook_chain_t *chain, void *before, void *after);
  */
 hook_err_t hook_wrap(void *func, int32_t argno, void *before, void *after, void *udata);
 
+/**
+ * @brief The same as hook_wrap but with explicit priority
+ * 
+ * @see hook_wrap
+ * @see hook_chain_add_priority
+ * 
+ * @param func 
+ * @param argno 
+ * @param before 
+ * @param after 
+ * @param udata 
+ * @param priority 
+ * @return hook_err_t 
+ */
+hook_err_t hook_wrap_priority(void *func, int32_t argno, void *before, void *after, void *udata, int32_t priority);
+
+/**
+ * @brief The same as hook_wrap_priority, flags are set on the chain, e.g. HOOK_CHAIN_NO_REENTRY
+ * 
+ * @see hook_wrap_priority
+ * 
+ * @param func 
+ * @param argno 
+ * @param before 
+ * @param after 
+ * @param udata 
+ * @param priority 
+ * @param flags 
+ * @return hook_err_t 
+ */
+hook_err_t hook_wrap_flags(void *func, int32_t argno, void *before, void *after, void *udata, int32_t priority,
+                           uint32_t flags);
+
+/**
+ * @brief The same as hook_wrap_priority, but before and after only run when the hooked function
+ * is called from one of callers, matched on the return address in the transit.
+ * When every callback of the chain is filtered, other calls go straight to the origin.
+ * 
+ * @see hook_wrap_priority
+ * 
+ * @param func 
+ * @param argno 
+ * @param before 
+ * @param after 
+ * @param udata 
+ * @param priority 
+ * @param callers 
+ * @param caller_num at most HOOK_CALLER_RANGE_NUM
+ * @return hook_err_t 
+ */
+hook_err_t hook_wrap_callers(void *func, int32_t argno, void *before, void *after, void *udata, int32_t priority,
+                             const hook_caller_range_t *callers, int32_t caller_num);
+
 /**
  * @brief 
  * 
@@ -319,6 +565,23 @@ static inline void hook_unwrap(void *func, void *before, void *after)
     return hook_unwrap_remove(func, before, after, 1);
 }
 
+/**
+ * @brief Restore the original instructions of a hooked function but keep the hook, or wrap chain, prepared.
+ * A single B trampoline makes this a one instruction patch.
+ * 
+ * @param func 
+ * @return hook_err_t -HOOK_NOT_FOUND if func is not hooked
+ */
+hook_err_t hook_disarm(void *func);
+
+/**
+ * @brief Re-install a hook disarmed by hook_disarm
+ * 
+ * @param func 
+ * @return hook_err_t 
+ */
+hook_err_t hook_arm(void *func);
+
 /**
  * @param hook_args
  */
@@ -338,6 +601,16 @@ static inline void *wrap_get_origin_func(void *hook_args)
  */
 void fp_hook(uintptr_t fp_addr, void *replace, void **backup);
 
+/**
+ * @brief fp_hook for num pointers, a read-only page is made writable once for all targets in it
+ * 
+ * @param fp_addrs 
+ * @param replaces 
+ * @param backups may be null
+ * @param num 
+ */
+void fp_hook_batch(const uintptr_t *fp_addrs, void *const *replaces, void **backups, int32_t num);
+
 /**
  * @brief 
  * 
@@ -358,6 +631,57 @@ void fp_unhook(uintptr_t fp_addr, void *backup);
  */
 hook_err_t fp_hook_wrap(uintptr_t fp_addr, int32_t argno, void *before, void *after, void *udata);
 
+/**
+ * @brief The same as fp_hook_wrap but with explicit priority
+ * 
+ * @see fp_hook_wrap
+ * 
+ * @param fp_addr 
+ * @param argno 
+ * @param before 
+ * @param after 
+ * @param udata 
+ * @param priority 
+ * @return hook_err_t 
+ */
+hook_err_t fp_hook_wrap_priority(uintptr_t fp_addr, int32_t argno, void *before, void *after, void *udata,
+                                 int32_t priority);
+
+/**
+ * @brief The same as fp_hook_wrap_priority, flags are set on the chain, e.g. HOOK_CHAIN_NO_REENTRY
+ * 
+ * @see fp_hook_wrap_priority
+ * 
+ * @param fp_addr 
+ * @param argno 
+ * @param before 
+ * @param after 
+ * @param udata 
+ * @param priority 
+ * @param flags 
+ * @return hook_err_t 
+ */
+hook_err_t fp_hook_wrap_flags(uintptr_t fp_addr, int32_t argno, void *before, void *after, void *udata,
+                              int32_t priority, uint32_t flags);
+
+/**
+ * @brief The same as fp_hook_wrap_priority, with caller ranges
+ * 
+ * @see hook_wrap_callers
+ * 
+ * @param fp_addr 
+ * @param argno 
+ * @param before 
+ * @param after 
+ * @param udata 
+ * @param priority 
+ * @param callers 
+ * @param caller_num at most HOOK_CALLER_RANGE_NUM
+ * @return hook_err_t 
+ */
+hook_err_t fp_hook_wrap_callers(uintptr_t fp_addr, int32_t argno, void *before, void *after, void *udata,
+                                int32_t priority, const hook_caller_range_t *callers, int32_t caller_num);
+
 /**
  * @brief 
  * 
@@ -367,6 +691,120 @@ hook_err_t fp_hook_wrap(uintptr_t fp_addr, int32_t argno, void *before, void *af
  */
 void fp_hook_unwrap(uintptr_t fp_addr, void *before, void *after);
 
+/**
+ * @brief Point fp_addr back to the original function, the chain is kept.
+ * 
+ * @param fp_addr 
+ * @return hook_err_t -HOOK_NOT_FOUND if fp_addr is not wrapped
+ */
+hook_err_t fp_hook_disarm(uintptr_t fp_addr);
+
+/**
+ * @brief Point fp_addr to the chain again
+ * 
+ * @param fp_addr 
+ * @return hook_err_t 
+ */
+hook_err_t fp_hook_arm(uintptr_t fp_addr);
+
+/**
+ * @brief Serialize hook changes. Held for short sections only, the holder must not sleep or wait for readers.
+ */
+void hook_lock();
+void hook_unlock();
+
+/**
+ * @brief Set how hook_reclaim waits, once kernel symbols are resolved
+ * 
+ * @param relax sleep a little between polls of the reader counters
+ * @param sync wait until no task is preempted on the transit instructions outside the reader counters,
+ * or between loading a restored function pointer and calling it, e.g. synchronize_rcu_tasks
+ */
+void hook_set_wait(void (*relax)(void), void (*sync)(void));
+
+/**
+ * @brief Set the kernel stack layout hook_transit_nested walks, once the task layout is resolved.
+ * Until then, or with size 0, no call is seen as nested.
+ * 
+ * @param task_offset offset of the stack pointer in task_struct, -1 if sp_el0 does not hold the task
+ * @param size THREAD_SIZE
+ */
+void hook_set_stack(int32_t task_offset, int32_t size);
+
+/**
+ * @brief Free replaced item arrays and unwrapped chains once no task can reach them.
+ * Replaced arrays are also freed without waiting when a later change of the same chain finds them unused.
+ * Sleeps, not for atomic context. Chains the calling task is running in can not be waited for, they are kept.
+ * The wait is bounded, arrays and chains whose readers do not return in time are kept as well.
+ * 
+ * @param owner 
+ * @return int32_t number of kept arrays and chains holding items of owner, of any owner if owner is null
+ */
+int32_t hook_reclaim(void *owner);
+
+/**
+ * @brief Set how the owner recorded on an added chain item is found, e.g. the module whose init the calling task runs.
+ * Called with the hook lock held, owner must not sleep or take the hook lock.
+ * 
+ * @param owner returns the owner of the calling task, null for none
+ */
+void hook_set_owner_fn(void *(*owner)(void));
+
+/**
+ * @brief Remove every chain and fp chain item of owner in one pass.
+ * Emptied chains are uninstalled with a single icache flush, then hook_reclaim waits once
+ * before the removed items and chains are freed.
+ * 
+ * @param owner 
+ * @return int32_t number of items of owner still installed or not yet freed, 0 when nothing of owner is left.
+ * Owner code must stay mapped unless 0 is returned.
+ */
+int32_t hook_release_owner(void *owner);
+
+/**
+ * @brief Visit every inline hook, chain and fp chain, stop when fn returns non-zero.
+ * Plain fp_hook replacements are not recorded and not visited.
+ * fn runs with the hook lock held, it must copy what it needs, must not sleep, copy to user or call hook functions,
+ * entry->items is only valid until fn returns.
+ * 
+ * @param fn 
+ * @param udata 
+ */
+void hook_for_each(int (*fn)(const hook_entry_t *entry, void *udata), void *udata);
+
+/**
+ * @brief Clone the ops table *slot points to into kp memory and point slot to the clone,
+ * other objects sharing the table keep native dispatch.
+ * 
+ * @param slot ops pointer field of the object, e.g. &file->f_op
+ * @param ops_size sizeof the ops struct
+ * @return fp_ops_clone_t* or 0
+ */
+fp_ops_clone_t *fp_ops_clone(void **slot, int32_t ops_size);
+
+/**
+ * @brief fp_hook_wrap the member at offset in the clone
+ * 
+ * @param clone 
+ * @param offset offsetof the member in the ops struct
+ * @param argno 
+ * @param before 
+ * @param after 
+ * @param udata 
+ * @return hook_err_t 
+ */
+hook_err_t fp_ops_clone_wrap(fp_ops_clone_t *clone, int32_t offset, int32_t argno, void *before, void *after,
+                             void *udata);
+
+/**
+ * @brief Restore the original ops pointer if slot still points to the clone, then release all wraps in the clone.
+ * Does not wait, a task can still run in the clone, it and its chains are freed by hook_reclaim.
+ * 
+ * @param clone 
+ * @return hook_err_t -HOOK_SLOT_CHANGED if slot was changed by someone else, the clone is kept
+ */
+hook_err_t fp_ops_clone_restore(fp_ops_clone_t *clone);
+
 /**
  * 
  */
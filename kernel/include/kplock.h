@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Copyright (C) 2023 bmax121. All Rights Reserved.
+ */
+
+#ifndef _KP_KPLOCK_H_
+#define _KP_KPLOCK_H_
+
+#include <stdint.h>
+
+// A plain spin lock usable before kernel symbols are resolved, held with irqs masked on the local cpu,
+// so neither an interrupt nor preemption can enter it on the cpu that holds it.
+// Holders must not sleep or wait for anything.
+typedef struct
+{
+    volatile uint32_t locked;
+    uint64_t flags; // daif of the holder before locking
+} kp_lock_t;
+
+#define KP_LOCK_INIT { 0, 0 }
+
+static inline void kp_lock(kp_lock_t *lock)
+{
+    uint64_t flags;
+    asm volatile("	mrs	%0, daif\n"
+                 "	msr	daifset, #3\n"
+                 : "=r"(flags)
+                 :
+                 : "memory");
+    uint32_t busy, tmp;
+    asm volatile("	sevl\n"
+                 "1:	wfe\n"
+                 "2:	ldaxr	%w0, %2\n"
+                 "	cbnz	%w0, 1b\n"
+                 "	stxr	%w1, %w3, %2\n"
+                 "	cbnz	%w1, 2b\n"
+                 : "=&r"(busy), "=&r"(tmp), "+Q"(lock->locked)
+                 : "r"(1)
+                 : "memory");
+    lock->flags = flags;
+}
+
+static inline void kp_unlock(kp_lock_t *lock)
+{
+    uint64_t flags = lock->flags;
+    // the release store clears the exclusive monitor of waiters, which wakes their wfe
+    asm volatile("stlr	wzr, %0" : "=Q"(lock->locked) : : "memory");
+    asm volatile("msr	daif, %0" : : "r"(flags) : "memory");
+}
+
+/**
+ * @brief Store new into *ptr if it still holds old
+ *
+ * @return void* the value found in *ptr
+ */
+static inline void *kp_cmpxchg_ptr(void **ptr, void *old, void *new)
+{
+    void *cur;
+    uint32_t tmp;
+    asm volatile("1:	ldaxr	%0, %2\n"
+                 "	cmp	%0, %3\n"
+                 "	b.ne	2f\n"
+                 "	stlxr	%w1, %4, %2\n"
+                 "	cbnz	%w1, 1b\n"
+                 "2:"
+                 : "=&r"(cur), "=&r"(tmp), "+Q"(*ptr)
+                 : "r"(old), "r"(new)
+                 : "cc", "memory");
+    return cur;
+}
+
+#endif
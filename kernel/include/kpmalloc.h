@@ -2,48 +2,74 @@
 #define _KP_KPMALLOC_H_
 
 #include <tlsf.h>
+#include <kplock.h>
 
 extern tlsf_t kp_rw_mem;
 extern tlsf_t kp_rox_mem;
 
+// tlsf is not thread safe, one lock for both pools
+extern kp_lock_t kp_mem_lock;
+
 static inline void *kp_malloc_exec(size_t bytes)
 {
-    return tlsf_malloc(kp_rox_mem, bytes);
+    kp_lock(&kp_mem_lock);
+    void *ptr = tlsf_malloc(kp_rox_mem, bytes);
+    kp_unlock(&kp_mem_lock);
+    return ptr;
 }
 
 static inline void *kp_memalign_exec(size_t align, size_t bytes)
 {
-    return tlsf_memalign(kp_rox_mem, align, bytes);
+    kp_lock(&kp_mem_lock);
+    void *ptr = tlsf_memalign(kp_rox_mem, align, bytes);
+    kp_unlock(&kp_mem_lock);
+    return ptr;
 }
 
 static inline void *kp_realloc_exec(void *ptr, size_t size)
 {
-    return tlsf_realloc(kp_rox_mem, ptr, size);
+    kp_lock(&kp_mem_lock);
+    ptr = tlsf_realloc(kp_rox_mem, ptr, size);
+    kp_unlock(&kp_mem_lock);
+    return ptr;
 }
 
 static inline void kp_free_exec(void *ptr)
 {
+    kp_lock(&kp_mem_lock);
     tlsf_free(kp_rox_mem, ptr);
+    kp_unlock(&kp_mem_lock);
 }
 
 static inline void *kp_malloc(size_t bytes)
 {
-    return tlsf_malloc(kp_rw_mem, bytes);
+    kp_lock(&kp_mem_lock);
+    void *ptr = tlsf_malloc(kp_rw_mem, bytes);
+    kp_unlock(&kp_mem_lock);
+    return ptr;
 }
 
 static inline void *kp_memalign(size_t align, size_t bytes)
 {
-    return tlsf_memalign(kp_rw_mem, align, bytes);
+    kp_lock(&kp_mem_lock);
+    void *ptr = tlsf_memalign(kp_rw_mem, align, bytes);
+    kp_unlock(&kp_mem_lock);
+    return ptr;
 }
 
 static inline void *kp_realloc(void *ptr, size_t size)
 {
-    return tlsf_realloc(kp_rw_mem, ptr, size);
+    kp_lock(&kp_mem_lock);
+    ptr = tlsf_realloc(kp_rw_mem, ptr, size);
+    kp_unlock(&kp_mem_lock);
+    return ptr;
 }
 
 static inline void kp_free(void *ptr)
 {
+    kp_lock(&kp_mem_lock);
     tlsf_free(kp_rw_mem, ptr);
+    kp_unlock(&kp_mem_lock);
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -19,6 +19,8 @@
 
 extern int16_t pt_regs_offset;
 
+// sizeof(struct pt_regs) of the running kernel version
+int pt_regs_size_of_kver();
 struct pt_regs *_task_pt_reg(struct task_struct *task);
 
 #define task_pt_regs(p) _task_pt_reg(p)
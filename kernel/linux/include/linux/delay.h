@@ -0,0 +1,9 @@
+#ifndef _LINUX_DELAY_H
+#define _LINUX_DELAY_H
+
+#include <ktypes.h>
+#include <ksyms.h>
+
+extern void kfunc_def(msleep)(unsigned int msecs);
+
+#endif
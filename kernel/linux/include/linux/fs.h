@@ -245,6 +245,12 @@ extern void kfunc_def(final_putname)(struct filename *name);
 
 extern loff_t kfunc_def(vfs_llseek)(struct file *file, loff_t offset, int whence);
 
+extern long kfunc_def(do_splice_direct)(struct file *in, loff_t *ppos, struct file *out, loff_t *opos, size_t len,
+                                       unsigned int flags);
+
+extern struct file *kfunc_def(fget)(unsigned int fd);
+extern void kfunc_def(fput)(struct file *);
+
 //
 
 static inline void inc_nlink(struct inode *inode)
@@ -303,7 +309,7 @@ static inline ssize_t kernel_write(struct file *file, const void *buf, size_t co
             }
             ret = result;
         } else {
-            kfunc(kernel_write)(file, buf, count, pos);
+            ret = kfunc(kernel_write)(file, buf, count, pos);
         }
     } else {
         kfunc_not_found();
@@ -357,6 +363,16 @@ static inline loff_t vfs_llseek(struct file *file, loff_t offset, int whence)
     kfunc_direct_call(vfs_llseek, file, offset, whence);
 }
 
+static inline struct file *fget(unsigned int fd)
+{
+    kfunc_direct_call(fget, fd);
+}
+
+static inline void fput(struct file *file)
+{
+    kfunc_direct_call_void(fput, file);
+}
+
 static inline void putname(struct filename *name)
 {
     kfunc_direct_call_void(putname, name);
@@ -0,0 +1,17 @@
+#ifndef _LINUX_KTHREAD_H
+#define _LINUX_KTHREAD_H
+
+#include <ktypes.h>
+#include <ksyms.h>
+
+#define NUMA_NO_NODE (-1)
+
+struct task_struct;
+
+extern struct task_struct *kfunc_def(kthread_create_on_node)(int (*threadfn)(void *data), void *data, int node,
+                                                              const char namefmt[], ...);
+extern void kfunc_def(kthread_bind)(struct task_struct *k, unsigned int cpu);
+// kernel/sched/core.c
+extern int kfunc_def(wake_up_process)(struct task_struct *p);
+
+#endif
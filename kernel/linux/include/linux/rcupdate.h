@@ -25,6 +25,8 @@ extern void kfunc_def(call_rcu)(struct rcu_head *head, rcu_callback_t func);
 extern void kfunc_def(rcu_barrier_tasks)(void);
 extern void kfunc_def(rcu_barrier_tasks_rude)(void);
 extern void kfunc_def(synchronize_rcu)(void);
+// CONFIG_TASKS_RCU, waits for every task to switch voluntarily, covers preempted tasks
+extern void kfunc_def(synchronize_rcu_tasks)(void);
 extern unsigned long kfunc_def(get_completed_synchronize_rcu)(void);
 extern void kfunc_def(get_completed_synchronize_rcu_full)(struct rcu_gp_oldstate *rgosp);
 
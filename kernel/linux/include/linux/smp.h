@@ -0,0 +1,18 @@
+#ifndef _LINUX_SMP_H
+#define _LINUX_SMP_H
+
+#include <ktypes.h>
+#include <ksyms.h>
+
+typedef void (*smp_call_func_t)(void *info);
+typedef bool (*smp_cond_func_t)(int cpu, void *info);
+
+struct cpumask;
+
+// an inline wrapper of on_each_cpu_cond_mask on newer kernels
+extern void kfunc_def(on_each_cpu)(smp_call_func_t func, void *info, int wait);
+// >= 5.7, no gfp_flags before mask
+extern void kfunc_def(on_each_cpu_cond_mask)(smp_cond_func_t cond_func, smp_call_func_t func, void *info, bool wait,
+                                             const struct cpumask *mask);
+
+#endif
@@ -10,6 +10,8 @@ struct cpumask;
 
 extern bool kvar_def(stop_machine_initialized);
 extern const struct cpumask *kvar_def(cpu_online_mask);
+// >= 4.5, cpu_online_mask is &__cpu_online_mask
+extern char kvar_def(__cpu_online_mask);
 
 /**
  * stop_machine: freeze the machine on all CPUs and run this function
@@ -55,6 +55,22 @@ extern long kfunc_def(strncpy_from_unsafe_user)(char *dst, const void __user *un
  */
 extern long kfunc_def(strncpy_from_user)(char *dest, const char __user *src, long count);
 
+// arm64 raw copy, returns the number of bytes NOT copied, faults fixed up by the kernel extable.
+// Caller is responsible for the address check and for PAN / TTBR0 uaccess state.
+extern unsigned long kfunc_def(__arch_copy_to_user)(void __user *to, const void *from, unsigned long n);
+extern unsigned long kfunc_def(__arch_copy_from_user)(void *to, const void __user *from, unsigned long n);
+// < 4.6
+extern unsigned long kfunc_def(__copy_to_user)(void __user *to, const void *from, unsigned long n);
+extern unsigned long kfunc_def(__copy_from_user)(void *to, const void __user *from, unsigned long n);
+// CONFIG_ARM64_SW_TTBR0_PAN, < 5.15 and >= 5.15
+extern char kvar_def(reserved_ttbr0);
+extern char kvar_def(reserved_pg_dir);
+
+// >= 5.8, returns 0 on success, -EFAULT otherwise, pagefaults disabled
+extern long kfunc_def(copy_from_user_nofault)(void *dst, const void __user *src, size_t size);
+// 5.3 - 5.7
+extern long kfunc_def(probe_user_read)(void *dst, const void __user *src, size_t size);
+
 // Unlike strnlen_user, this can be used from IRQ handler etc. because it disables pagefaults.
 extern long kfunc_def(strnlen_user_nofault)(const void __user *unsafe_addr, long count);
 extern long kfunc_def(strnlen_unsafe_user)(const void __user *unsafe_addr, long count);
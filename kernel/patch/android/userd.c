@@ -32,6 +32,7 @@
 #include <linux/umh.h>
 #include <uapi/scdefs.h>
 #include <uapi/linux/stat.h>
+#include <user_event.h>
 
 #define ORIGIN_RC_FILE "/system/etc/init/atrace.rc"
 #define REPLACE_RC_FILE "/dev/user_init.rc"
@@ -47,50 +48,26 @@
 
 #include "gen/user_init.c"
 
+#define AP_KPMS_DIR AP_DIR "kpms/"
+
+// stage is reported in kernel, user_init.sh is only executed when some handler needs it
+#define USER_STAGE(stage) "    exec -- " SUPERCMD " su stage " stage " " USER_INIT_SH_PATH " %s " stage "\n"
+
 static const char user_rc_data[] = { //
     "\n"
-    "on early-init\n"
-    "    exec -- " SUPERCMD " su exec " USER_INIT_SH_PATH " %s early-init\n"
-    "on init\n"
-    "    exec -- " SUPERCMD " su exec " USER_INIT_SH_PATH " %s init\n"
-    "on late-init\n"
-    "    exec -- " SUPERCMD " su exec " USER_INIT_SH_PATH " %s late-init\n"
-    "on post-fs-data\n"
-    "    exec -- " SUPERCMD " su exec " USER_INIT_SH_PATH " %s post-fs-data\n"
-    "on nonencrypted\n"
-    "    exec -- " SUPERCMD " su exec " USER_INIT_SH_PATH " %s services\n"
-    "on property:vold.decrypt=trigger_restart_framework\n"
-    "    exec -- " SUPERCMD " su exec " USER_INIT_SH_PATH " %s services\n"
-    "on property:sys.boot_completed=1\n"
-    "    exec -- " SUPERCMD " su exec " USER_INIT_SH_PATH " %s boot-completed\n"
+    "on early-init\n" USER_STAGE("early-init") //
+    "on init\n" USER_STAGE("init") //
+    "on late-init\n" USER_STAGE("late-init") //
+    "on post-fs-data\n" USER_STAGE("post-fs-data") //
+    "on nonencrypted\n" USER_STAGE("services") //
+    "on property:vold.decrypt=trigger_restart_framework\n" USER_STAGE("services") //
+    "on property:sys.boot_completed=1\n" USER_STAGE("boot-completed") //
     "    rm " REPLACE_RC_FILE "\n"
     "    rm " USER_INIT_SH_PATH "\n"
     "    exec -- " SUPERCMD " su -c \"mv -f " DEV_LOG_DIR " " AP_LOG_DIR "\"\n"
     ""
 };
 
-static const void *kernel_read_file(const char *path, loff_t *len)
-{
-    set_priv_sel_allow(current, true);
-    void *data = 0;
-
-    struct file *filp = filp_open(path, O_RDONLY, 0);
-    if (!filp || IS_ERR(filp)) {
-        log_boot("open file: %s error: %d\n", path, PTR_ERR(filp));
-        goto out;
-    }
-    *len = vfs_llseek(filp, 0, SEEK_END);
-    vfs_llseek(filp, 0, SEEK_SET);
-    data = vmalloc(*len);
-    loff_t pos = 0;
-    kernel_read(filp, data, *len, &pos);
-    filp_close(filp, 0);
-
-out:
-    set_priv_sel_allow(current, false);
-    return data;
-}
-
 static loff_t kernel_write_file(const char *path, const void *data, loff_t len, umode_t mode)
 {
     loff_t off = 0;
@@ -115,10 +92,39 @@ out:
     return off;
 }
 
+static bool kernel_file_exists(const char *path)
+{
+    set_priv_sel_allow(current, true);
+    struct file *filp = filp_open(path, O_RDONLY, 0);
+    bool exists = filp && !IS_ERR(filp);
+    if (exists) filp_close(filp, 0);
+    set_priv_sel_allow(current, false);
+    return exists;
+}
+
+// user_init.sh has nothing to do before post-fs-data, or without apd, kpms and magiskpolicy
+static int user_init_stage_handler(const char *event, const char *args, void *udata)
+{
+    if (args) return 0;
+    if (strcmp(event, "post-fs-data") && strcmp(event, "services") && strcmp(event, "boot-completed")) return 0;
+    if (kernel_file_exists(APD_PATH) || kernel_file_exists(AP_KPMS_DIR) || kernel_file_exists(AP_MAGISKPOLICY_PATH)) {
+        return USER_EVENT_RUN_USER;
+    }
+    log_boot("stage %s, no user init\n", event);
+    return 0;
+}
+
+static void before_openat(hook_fargs4_t *args, void *udata);
+static void after_openat(hook_fargs4_t *args, void *udata);
+
 static void pre_user_exec_init()
 {
     log_boot("event: %s\n", EXTRA_EVENT_PRE_EXEC_INIT);
     kernel_write_file(USER_INIT_SH_PATH, user_init, sizeof(user_init), 0700);
+
+    // rc files are only parsed by init, no need to watch openat before it
+    hook_err_t rc = hook_syscalln(__NR_openat, 4, before_openat, after_openat, 0);
+    log_boot("hook __NR_openat rc: %d\n", rc);
 }
 
 static void pre_init_second_stage()
@@ -252,6 +258,42 @@ static void after_execveat(hook_fargs5_t *args, void *udata)
     handle_after_execve(&args->local);
 }
 
+// stream the original rc into the tmpfs copy, page cache to page cache
+static loff_t copy_origin_rc(struct file *newfp)
+{
+    loff_t off = 0;
+    set_priv_sel_allow(current, true);
+
+    struct file *orifp = filp_open(ORIGIN_RC_FILE, O_RDONLY, 0);
+    if (!orifp || IS_ERR(orifp)) {
+        log_boot("open file: %s error: %d\n", ORIGIN_RC_FILE, PTR_ERR(orifp));
+        goto out;
+    }
+    loff_t ori_len = vfs_llseek(orifp, 0, SEEK_END);
+    loff_t pos = 0;
+    vfs_llseek(orifp, 0, SEEK_SET);
+
+    if (kfunc(do_splice_direct)) kfunc(do_splice_direct)(orifp, &pos, newfp, &off, ori_len, 0);
+
+    // no splice, bounce through a small buffer
+    if (off != ori_len) {
+        char buf[512];
+        while (off < ori_len) {
+            pos = off;
+            ssize_t rlen = kernel_read(orifp, buf, sizeof(buf), &pos);
+            if (rlen <= 0) break;
+            ssize_t wlen = kernel_write(newfp, buf, rlen, &off);
+            if (wlen != rlen) break;
+        }
+    }
+    if (off != ori_len) log_boot("copy rc error: %llx, %llx\n", off, ori_len);
+
+    filp_close(orifp, 0);
+out:
+    set_priv_sel_allow(current, false);
+    return off;
+}
+
 // https://elixir.bootlin.com/linux/v6.1/source/fs/open.c#L1337
 // SYSCALL_DEFINE4(openat, int, dfd, const char __user *, filename, int, flags, umode_t, mode)
 static void before_openat(hook_fargs4_t *args, void *udata)
@@ -267,6 +309,12 @@ static void before_openat(hook_fargs4_t *args, void *udata)
     if (replaced) return;
 
     const char __user *filename = (typeof(filename))syscall_argn(args, 1);
+
+    // reject by the first 8 bytes before copying the whole path
+    uint64_t prefix = 0;
+    if (compat_copy_from_user(&prefix, filename, sizeof(prefix)) != sizeof(prefix)) return;
+    if (memcmp(&prefix, ORIGIN_RC_FILE, sizeof(prefix))) return;
+
     char buf[32];
     long rc = compat_strncpy_from_user(buf, filename, sizeof(buf));
     if (rc <= 0) return;
@@ -274,21 +322,16 @@ static void before_openat(hook_fargs4_t *args, void *udata)
 
     replaced = 1;
 
-    loff_t ori_len = 0;
-    struct file *newfp = filp_open(REPLACE_RC_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    // tmpfs, memory backed, read only once written
+    struct file *newfp = filp_open(REPLACE_RC_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0400);
     if (!newfp || IS_ERR(newfp)) {
         log_boot("create replace rc error: %d\n", PTR_ERR(newfp));
         goto out;
     }
 
-    loff_t off = 0;
-    const char *ori_rc_data = kernel_read_file(ORIGIN_RC_FILE, &ori_len);
-    if (!ori_rc_data) goto out;
-    kernel_write(newfp, ori_rc_data, ori_len, &off);
-    if (off != ori_len) {
-        log_boot("write replace rc error: %x\n", off);
-        goto free;
-    }
+    loff_t off = copy_origin_rc(newfp);
+    loff_t ori_len = off;
+    if (off <= 0) goto free;
 
     char added_rc_data[4096];
     const char *sk = get_superkey();
@@ -314,7 +357,6 @@ static void before_openat(hook_fargs4_t *args, void *udata)
 
 free:
     filp_close(newfp, 0);
-    kvfree(ori_rc_data);
 
 out:
     args->local.data2 = 1;
@@ -359,6 +401,9 @@ int android_user_init()
     hook_err_t ret = 0;
     hook_err_t rc = HOOK_NO_ERR;
 
+    rc = add_user_event_handler(user_init_stage_handler, 0);
+    log_boot("add user init stage handler rc: %d\n", rc);
+
     rc = hook_syscalln(__NR_execve, 3, before_execve, after_execve, (void *)__NR_execve);
     log_boot("hook __NR_execve rc: %d\n", rc);
     ret |= rc;
@@ -367,10 +412,6 @@ int android_user_init()
     log_boot("hook __NR_execveat rc: %d\n", rc);
     ret |= rc;
 
-    rc = hook_syscalln(__NR_openat, 4, before_openat, after_openat, 0);
-    log_boot("hook __NR_openat rc: %d\n", rc);
-    ret |= rc;
-
     unsigned long input_handle_event_addr = patch_config->input_handle_event;
     if (input_handle_event_addr) {
         rc = hook_wrap4((void *)input_handle_event_addr, before_input_handle_event, 0, 0);
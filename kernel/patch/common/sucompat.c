@@ -47,7 +47,17 @@ const char legacy_su_path[] = LEGACY_SU_PATH;
 const char apd_path[] = APD_PATH;
 #endif
 
-static const char *current_su_path = 0;
+// immutable once published, replaced as a whole by su_reset_path
+struct su_path
+{
+    struct rcu_head rcu;
+    int len;
+    char path[SU_PATH_MAX_LEN];
+};
+
+static struct su_path default_su = { .len = sizeof(SU_PATH) - 1, .path = SU_PATH };
+static struct su_path *current_su_path = &default_su;
+static spinlock_t su_path_lock;
 
 static int su_kstorage_gid = -1;
 static int exclude_kstorage_gid = -1;
@@ -94,100 +104,216 @@ int su_allow_uid_nums()
 }
 KP_EXPORT_SYMBOL(su_allow_uid_nums);
 
-static int allow_uids_cb(struct kstorage *kstorage, void *udata)
+struct allow_list_udata
 {
-    struct
-    {
-        int is_user;
-        uid_t *out_uids;
-        int idx;
-        int out_num;
-    } *up = (typeof(up))udata;
-
-    if (up->idx >= up->out_num) {
-        return -ENOBUFS;
-    }
-
+    void *out;
+    int flags;
+    int out_num;
+    int start;
+    int total;
+};
+
+static int allow_list_cb(struct kstorage *kstorage, void *udata)
+{
+    struct allow_list_udata *up = (struct allow_list_udata *)udata;
     struct su_profile *profile = (struct su_profile *)kstorage->data;
 
-    if (up->is_user) {
-        int cprc = compat_copy_to_user(up->out_uids + up->idx, &profile->uid, sizeof(uid_t));
-        if (cprc <= 0) {
-            logkfd("compat_copy_to_user error: %d", cprc);
-            return cprc;
+    int i = up->total - up->start;
+    if (i >= 0 && i < up->out_num) {
+        if (up->flags & SU_LIST_FLAG_PROFILE) {
+            memcpy((struct su_profile *)up->out + i, profile, sizeof(struct su_profile));
+        } else {
+            ((uid_t *)up->out)[i] = profile->uid;
         }
-    } else {
-        up->out_uids[up->idx] = profile->uid;
     }
-
-    up->idx++;
+    up->total++;
 
     return 0;
 }
 
-int su_allow_uids(int is_user, uid_t *out_uids, int out_num)
+/**
+ * @brief Fill the kernel buffer out with the allowed uids or profiles [start, start + out_num), for paged listing
+ * 
+ * @param start 
+ * @param out uid_t array, or struct su_profile array if SU_LIST_FLAG_PROFILE in flags
+ * @param out_num 
+ * @param flags SU_LIST_FLAG_*
+ * @return int total number of allowed uids, or negative error
+ */
+int su_allow_list_from(int start, void *out, int out_num, int flags)
 {
-    struct
-    {
-        int iu;
-        uid_t *up;
-        int idx;
-        int out_num;
-    } udata = { is_user, out_uids, 0, out_num };
-
-    on_each_kstorage_elem(su_kstorage_gid, allow_uids_cb, &udata);
+    if (start < 0 || out_num < 0 || (out_num && !out)) return -EINVAL;
+    struct allow_list_udata udata = { out, flags, out_num, start, 0 };
+    on_each_kstorage_elem(su_kstorage_gid, allow_list_cb, &udata);
+    return udata.total;
+}
+KP_EXPORT_SYMBOL(su_allow_list_from);
+
+/**
+ * @brief List su allowed uids or their profiles
+ * 
+ * @param is_user out is a user buffer
+ * @param out uid_t array, or struct su_profile array if SU_LIST_FLAG_PROFILE in flags
+ * @param out_num number of elements out can hold, 0 to only count
+ * @param flags SU_LIST_FLAG_*
+ * @return int total number of allowed uids, may be greater than out_num, or negative error
+ */
+int su_allow_list(int is_user, void *out, int out_num, int flags)
+{
+    int esize = flags & SU_LIST_FLAG_PROFILE ? sizeof(struct su_profile) : sizeof(uid_t);
+    if (out_num < 0 || (out_num && !out)) return -EINVAL;
+
+    if (!is_user || !out_num) return su_allow_list_from(0, out, out_num, flags);
+    struct allow_list_udata udata = { out, flags, out_num, 0, 0 };
+
+    // stage in kernel, then a single copy after the rcu walk
+    int num = su_allow_uid_nums();
+    if (num > out_num) num = out_num;
+    void *buf = 0;
+    if (num > 0) {
+        buf = vmalloc(num * esize);
+        if (!buf) return -ENOMEM;
+    }
+    udata.out = buf;
+    udata.out_num = num;
+    on_each_kstorage_elem(su_kstorage_gid, allow_list_cb, &udata);
+
+    int filled = udata.total < num ? udata.total : num;
+    int rc = udata.total;
+    if (filled > 0) {
+        int cplen = compat_copy_to_user(out, buf, filled * esize);
+        if (cplen <= 0) {
+            logkfd("compat_copy_to_user error: %d", cplen);
+            rc = cplen ?: -EFAULT;
+        }
+    }
+    if (buf) vfree(buf);
+    return rc;
+}
+KP_EXPORT_SYMBOL(su_allow_list);
 
-    return udata.idx;
+int su_allow_uids(int is_user, uid_t *out_uids, int out_num)
+{
+    int total = su_allow_list(is_user, out_uids, out_num, 0);
+    if (total < 0) return total;
+    return total < out_num ? total : out_num;
 }
 KP_EXPORT_SYMBOL(su_allow_uids);
 
 int su_allow_uid_profile(int is_user, uid_t uid, struct su_profile *out_profile)
 {
-    int rc = 0;
+    struct su_profile profile;
 
     rcu_read_lock();
     const struct kstorage *ks = get_kstorage(su_kstorage_gid, uid);
     if (IS_ERR(ks)) {
-        rc = -ENOENT;
-        goto out;
+        rcu_read_unlock();
+        return -ENOENT;
     }
-    struct su_profile *profile = (struct su_profile *)ks->data;
+    memcpy(&profile, ks->data, sizeof(struct su_profile));
+    rcu_read_unlock();
 
-    if (is_user) {
-        rc = compat_copy_to_user(out_profile, profile, sizeof(struct su_profile));
-        if (rc <= 0) {
-            logkfd("compat_copy_to_user error: %d", rc);
-            goto out;
-        }
-    } else {
-        memcpy(out_profile, profile, sizeof(struct su_profile));
+    if (!is_user) {
+        memcpy(out_profile, &profile, sizeof(struct su_profile));
+        return 0;
     }
 
-out:
-    rcu_read_unlock();
+    // copy after unlock, user access may fault
+    int rc = compat_copy_to_user(out_profile, &profile, sizeof(struct su_profile));
+    if (rc <= 0) logkfd("compat_copy_to_user error: %d", rc);
     return rc;
 }
 KP_EXPORT_SYMBOL(su_allow_uid_profile);
 
-// no free, no lock
+static void su_path_reclaim(struct rcu_head *rcu)
+{
+    struct su_path *sp = container_of(rcu, struct su_path, rcu);
+    kvfree(sp);
+}
+
+/**
+ * @brief Replace the su path, path is copied
+ * 
+ * @param path 
+ * @return int 
+ */
 int su_reset_path(const char *path)
 {
     if (!path) return -EINVAL;
     if (IS_ERR(path)) return PTR_ERR(path);
-    current_su_path = path;
-    logkfd("%s\n", current_su_path);
-    dsb(ish);
+    int len = strnlen(path, SU_PATH_MAX_LEN);
+    if (len <= 0 || len >= SU_PATH_MAX_LEN) return -EINVAL;
+
+    struct su_path *new = (struct su_path *)vmalloc(sizeof(struct su_path));
+    if (!new) return -ENOMEM;
+    new->len = len;
+    memcpy(new->path, path, len);
+    new->path[len] = '\0';
+
+    spin_lock(&su_path_lock);
+    struct su_path *old = current_su_path;
+    rcu_assign_pointer(current_su_path, new);
+    spin_unlock(&su_path_lock);
+
+    logkfd("%s\n", new->path);
+    if (old != &default_su) call_rcu(&old->rcu, su_path_reclaim);
     return 0;
 }
 KP_EXPORT_SYMBOL(su_reset_path);
 
+/**
+ * @brief Copy the current su path
+ * 
+ * @param buf 
+ * @param buf_len 
+ * @return int length of path, -ENOBUFS if buf is too small
+ */
+int su_get_path_copy(char *buf, int buf_len)
+{
+    rcu_read_lock();
+    const struct su_path *sp = rcu_dereference(current_su_path);
+    int len = sp->len;
+    if (buf_len > len) memcpy(buf, sp->path, len + 1);
+    rcu_read_unlock();
+    return buf_len > len ? len : -ENOBUFS;
+}
+KP_EXPORT_SYMBOL(su_get_path_copy);
+
+/**
+ * @brief Get the current su path
+ * 
+ * Kept for existing modules. The returned string is freed after a grace period
+ * once the path is reset, use su_get_path_copy instead.
+ * 
+ * @return const char* 
+ */
 const char *su_get_path()
 {
-    if (!current_su_path) current_su_path = default_su_path;
-    return current_su_path;
+    return rcu_dereference_raw(current_su_path)->path;
 }
 KP_EXPORT_SYMBOL(su_get_path);
 
+/**
+ * @brief Whether name is the su path
+ * 
+ * @param name 
+ * @param len length of name, or negative if unknown
+ * @return bool 
+ */
+static bool is_su_path(const char *name, int len)
+{
+    bool rc;
+    rcu_read_lock();
+    const struct su_path *sp = rcu_dereference(current_su_path);
+    if (len >= 0) {
+        rc = sp->len == len && !memcmp(sp->path, name, len);
+    } else {
+        rc = !strncmp(sp->path, name, sp->len + 1);
+    }
+    rcu_read_unlock();
+    return rc;
+}
+
 static void handle_before_execve(char **__user u_filename_p, char **__user uargv, void *udata)
 {
     char __user *ufilename = *u_filename_p;
@@ -195,7 +321,7 @@ static void handle_before_execve(char **__user u_filename_p, char **__user uargv
     int flen = compat_strncpy_from_user(filename, ufilename, sizeof(filename));
     if (flen <= 0) return;
 
-    if (!strcmp(current_su_path, filename)) {
+    if (is_su_path(filename, flen - 1)) {
         uid_t uid = current_uid();
         struct su_profile profile;
         if (su_allow_uid_profile(0, uid, &profile)) return;
@@ -313,7 +439,7 @@ static void su_handler_arg1_ufilename_before(hook_fargs6_t *args, void *udata)
     int flen = compat_strncpy_from_user(filename, *u_filename_p, sizeof(filename));
     if (flen <= 0) return;
 
-    if (!strcmp(current_su_path, filename)) {
+    if (is_su_path(filename, flen - 1)) {
         void *uptr = copy_to_user_stack(sh_path, sizeof(sh_path));
         if (uptr && !IS_ERR(uptr)) {
             *u_filename_p = uptr;
@@ -323,6 +449,67 @@ static void su_handler_arg1_ufilename_before(hook_fargs6_t *args, void *udata)
     }
 }
 
+// Only the stat and access family of syscalls sees sh_path for su, open, exec and the rest keep the name.
+static bool in_su_path_syscall()
+{
+    struct pt_regs *regs = task_pt_regs(current);
+    // syscallno is right after orig_x0 in every pt_regs layout, s32 or the low word of u64
+    int nr = (int)regs->syscallno;
+    if (compat_user_mode(regs)) {
+        // __NR_fstatat64 327, __NR_faccessat 334, __NR_statx 397, __NR_faccessat2 439
+        return nr == 327 || nr == 334 || nr == 397 || nr == 439;
+    }
+    return nr == __NR3264_fstatat || nr == __NR_faccessat || nr == __NR_statx || nr == __NR_faccessat2;
+}
+
+// https://elixir.bootlin.com/linux/v6.1/source/fs/namei.c#L130
+// struct filename *getname_flags(const char __user *filename, int flags, int *empty)
+
+// https://elixir.bootlin.com/linux/v6.8/source/fs/namei.c#L130
+// struct filename *getname_flags(const char __user *filename, int flags)
+static void su_handler_getname_after(hook_fargs3_t *args, void *udata)
+{
+    struct filename *fname = (struct filename *)args->ret;
+    if (IS_ERR_OR_NULL(fname)) return;
+
+    // the name is already in kernel, compare it before any uid lookup
+    if (!is_su_path(fname->name, -1)) return;
+
+    if (!in_su_path_syscall()) return;
+
+    uid_t uid = current_uid();
+    if (!is_su_allow_uid(uid)) return;
+
+    // name is always backed by a PATH_MAX buffer, either iname or a separate names_cache object
+    memcpy((char *)fname->name, sh_path, sizeof(sh_path));
+}
+
+static hook_err_t hook_path_lookup()
+{
+    void *getname_flags = (void *)kallsyms_lookup_name("getname_flags");
+    if (!getname_flags) return -HOOK_BAD_ADDRESS;
+    return hook_wrap3(getname_flags, 0, su_handler_getname_after, 0);
+}
+
+static void hook_path_syscalls()
+{
+    hook_err_t rc = HOOK_NO_ERR;
+
+    rc = hook_syscalln(__NR3264_fstatat, 4, su_handler_arg1_ufilename_before, 0, (void *)0);
+    log_boot("hook __NR3264_fstatat rc: %d\n", rc);
+
+    rc = hook_syscalln(__NR_faccessat, 3, su_handler_arg1_ufilename_before, 0, (void *)0);
+    log_boot("hook __NR_faccessat rc: %d\n", rc);
+
+    // __NR_fstatat64 327
+    rc = hook_compat_syscalln(327, 4, su_handler_arg1_ufilename_before, 0, (void *)0);
+    log_boot("hook 32 __NR_fstatat64 rc: %d\n", rc);
+
+    //  __NR_faccessat 334
+    rc = hook_compat_syscalln(334, 3, su_handler_arg1_ufilename_before, 0, (void *)0);
+    log_boot("hook 32 __NR_faccessat rc: %d\n", rc);
+}
+
 int set_ap_mod_exclude(uid_t uid, int exclude)
 {
     int rc = 0;
@@ -357,7 +544,7 @@ KP_EXPORT_SYMBOL(list_ap_mod_exclude);
 
 int su_compat_init()
 {
-    current_su_path = default_su_path;
+    spin_lock_init(&su_path_lock);
 
     su_kstorage_gid = try_alloc_kstroage_group();
     if (su_kstorage_gid != KSTORAGE_SU_LIST_GROUP) return -ENOMEM;
@@ -386,23 +573,14 @@ int su_compat_init()
     rc = hook_syscalln(__NR_execve, 3, before_execve, 0, (void *)0);
     log_boot("hook __NR_execve rc: %d\n", rc);
 
-    rc = hook_syscalln(__NR3264_fstatat, 4, su_handler_arg1_ufilename_before, 0, (void *)0);
-    log_boot("hook __NR3264_fstatat rc: %d\n", rc);
-
-    rc = hook_syscalln(__NR_faccessat, 3, su_handler_arg1_ufilename_before, 0, (void *)0);
-    log_boot("hook __NR_faccessat rc: %d\n", rc);
-
     // __NR_execve 11
     rc = hook_compat_syscalln(11, 3, before_execve, 0, (void *)1);
     log_boot("hook 32 __NR_execve rc: %d\n", rc);
 
-    // __NR_fstatat64 327
-    rc = hook_compat_syscalln(327, 4, su_handler_arg1_ufilename_before, 0, (void *)0);
-    log_boot("hook 32 __NR_fstatat64 rc: %d\n", rc);
-
-    //  __NR_faccessat 334
-    rc = hook_compat_syscalln(334, 3, su_handler_arg1_ufilename_before, 0, (void *)0);
-    log_boot("hook 32 __NR_faccessat rc: %d\n", rc);
+    // stat and access of su path, one path lookup hook covers native and compat syscalls
+    rc = hook_path_lookup();
+    log_boot("hook getname_flags rc: %d\n", rc);
+    if (rc) hook_path_syscalls();
 
     return 0;
 }
\ No newline at end of file
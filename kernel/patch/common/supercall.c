@@ -128,24 +128,28 @@ static long call_kpm_info(const char *__user uname, char *__user out_info, int o
     return sz;
 }
 
-static long call_su(struct su_profile *__user uprofile)
+static long copy_su_profile(struct su_profile *profile, struct su_profile *__user uprofile)
 {
-    struct su_profile *profile = memdup_user(uprofile, sizeof(struct su_profile));
-    if (!profile || IS_ERR(profile)) return PTR_ERR(profile);
+    int cplen = compat_copy_from_user(profile, uprofile, sizeof(struct su_profile));
+    if (cplen <= 0) return cplen ?: -EFAULT;
     profile->scontext[sizeof(profile->scontext) - 1] = '\0';
-    int rc = commit_su(profile->to_uid, profile->scontext);
-    kvfree(profile);
-    return rc;
+    return 0;
+}
+
+static long call_su(struct su_profile *__user uprofile)
+{
+    struct su_profile profile;
+    long rc = copy_su_profile(&profile, uprofile);
+    if (rc) return rc;
+    return commit_su(profile.to_uid, profile.scontext);
 }
 
 static long call_su_task(pid_t pid, struct su_profile *__user uprofile)
 {
-    struct su_profile *profile = memdup_user(uprofile, sizeof(struct su_profile));
-    if (!profile || IS_ERR(profile)) return PTR_ERR(profile);
-    profile->scontext[sizeof(profile->scontext) - 1] = '\0';
-    int rc = task_su(pid, profile->to_uid, profile->scontext);
-    kvfree(profile);
-    return rc;
+    struct su_profile profile;
+    long rc = copy_su_profile(&profile, uprofile);
+    if (rc) return rc;
+    return task_su(pid, profile.to_uid, profile.scontext);
 }
 
 static long call_skey_get(char *__user out_key, int out_len)
@@ -174,11 +178,10 @@ static long call_skey_root_enable(int enable)
 
 static long call_grant_uid(struct su_profile *__user uprofile)
 {
-    struct su_profile *profile = memdup_user(uprofile, sizeof(struct su_profile));
-    if (!profile || IS_ERR(profile)) return PTR_ERR(profile);
-    int rc = su_add_allow_uid(profile->uid, profile->to_uid, profile->scontext);
-    kvfree(profile);
-    return rc;
+    struct su_profile profile;
+    long rc = copy_su_profile(&profile, uprofile);
+    if (rc) return rc;
+    return su_add_allow_uid(profile.uid, profile.to_uid, profile.scontext);
 }
 
 static long call_revoke_uid(uid_t uid)
@@ -206,6 +209,11 @@ static long call_su_list_allow_uid(uid_t *__user uids, int num)
     return su_allow_uids(1, uids, num);
 }
 
+static long call_su_allow_list(void *__user out, int num, int flags)
+{
+    return su_allow_list(1, out, num, flags);
+}
+
 static long call_su_allow_uid_profile(uid_t uid, struct su_profile *__user uprofile)
 {
     return su_allow_uid_profile(1, uid, uprofile);
@@ -213,13 +221,19 @@ static long call_su_allow_uid_profile(uid_t uid, struct su_profile *__user uprof
 
 static long call_reset_su_path(const char *__user upath)
 {
-    return su_reset_path(strndup_user(upath, SU_PATH_MAX_LEN));
+    // one spare byte, a full buffer then means the user string was truncated
+    char path[SU_PATH_MAX_LEN + 1];
+    long len = compat_strncpy_from_user(path, upath, sizeof(path));
+    if (len <= 0) return len ?: -EINVAL;
+    if (len > sizeof(path) - 1) return -ENAMETOOLONG;
+    return su_reset_path(path);
 }
 
 static long call_su_get_path(char *__user ubuf, int buf_len)
 {
-    const char *path = su_get_path();
-    int len = strlen(path);
+    char path[SU_PATH_MAX_LEN];
+    int len = su_get_path_copy(path, sizeof(path));
+    if (len < 0) return len;
     if (buf_len <= len) return -ENOBUFS;
     return compat_copy_to_user(ubuf, path, len + 1);
 }
@@ -260,6 +274,11 @@ static long call_kstorage_remove(int gid, long did)
     return remove_kstorage(gid, did);
 }
 
+static long call_hook_list(struct hook_info *__user out, int start, int num)
+{
+    return list_hooks(out, start, num);
+}
+
 static long supercall(int is_key_auth, long cmd, long arg1, long arg2, long arg3, long arg4)
 {
     switch (cmd) {
@@ -290,6 +309,8 @@ static long supercall(int is_key_auth, long cmd, long arg1, long arg2, long arg3
         return call_su_allow_uid_nums();
     case SUPERCALL_SU_LIST:
         return call_su_list_allow_uid((uid_t *)arg1, (int)arg2);
+    case SUPERCALL_SU_LIST_EX:
+        return call_su_allow_list((void *)arg1, (int)arg2, (int)arg3);
     case SUPERCALL_SU_PROFILE:
         return call_su_allow_uid_profile((uid_t)arg1, (struct su_profile * __user) arg2);
     case SUPERCALL_SU_RESET_PATH:
@@ -355,6 +376,8 @@ static long supercall(int is_key_auth, long cmd, long arg1, long arg2, long arg3
         return call_kpm_list((char *__user)arg1, (int)arg2);
     case SUPERCALL_KPM_INFO:
         return call_kpm_info((const char *__user)arg1, (char *__user)arg2, (int)arg3);
+    case SUPERCALL_HOOK_LIST:
+        return call_hook_list((struct hook_info * __user) arg1, (int)arg2, (int)arg3);
     }
 
     switch (cmd) {
@@ -14,8 +14,12 @@
 #include <linux/ptrace.h>
 #include <accctl.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
 #include <module.h>
 #include <user_event.h>
+#include <linux/fs.h>
+#include <linux/sched/task.h>
+#include <uapi/linux/fs.h>
 
 static char *__user supercmd_str_to_user_sp(const char *data, uintptr_t *sp)
 {
@@ -36,24 +40,197 @@ static void supercmd_exec(char **__user u_filename_p, const char *cmd, uintptr_t
     if (cplen <= 0) *u_filename_p = supercmd_str_to_user_sp(cmd, sp);
 }
 
-static void supercmd_echo(char **__user u_filename_p, char **__user uargv, uintptr_t *sp, const char *fmt, ...)
+// echo prefix and msg, echo puts a space between them
+static void supercmd_echo(char **__user u_filename_p, char **__user uargv, uintptr_t *sp, const char *prefix,
+                          const char *msg)
 {
     supercmd_exec(u_filename_p, ECHO_PATH, sp);
 
-    char buffer[4096];
-    va_list va;
-    va_start(va, fmt);
-    vsnprintf(buffer, sizeof(buffer), fmt, va);
-    va_end(va);
-
     const char *__user cmd = supercmd_str_to_user_sp(ECHO_PATH, sp);
-    const char *__user argv1 = supercmd_str_to_user_sp(buffer, sp);
+    int argi = 0;
+    set_user_arg_ptr(0, *uargv, argi++, (uintptr_t)cmd);
+    if (prefix) set_user_arg_ptr(0, *uargv, argi++, (uintptr_t)supercmd_str_to_user_sp(prefix, sp));
+    set_user_arg_ptr(0, *uargv, argi++, (uintptr_t)supercmd_str_to_user_sp(msg, sp));
+    set_user_arg_ptr(0, *uargv, argi, 0);
+}
+
+struct cmd_res
+{
+    const char *msg;
+    const char *err_msg;
+    int rc;
+};
+
+// write to the caller's stdout, 0 if all written
+static int supercmd_write_stdout(const char *data, int len)
+{
+    if (!kfunc(fget) || !kfunc(fput) || !kfunc(kernel_write)) return -ENOSYS;
+
+    struct file *fp = fget(1);
+    if (!fp || IS_ERR(fp)) return -EBADF;
+
+    // pipes and ttys have no position
+    loff_t pos = kfunc(vfs_llseek) ? vfs_llseek(fp, 0, SEEK_CUR) : 0;
+    bool seekable = pos >= 0 && kfunc(vfs_llseek);
+    if (!seekable) pos = 0;
+
+    ssize_t wlen = kernel_write(fp, data, len, &pos);
+    if (seekable && wlen > 0) vfs_llseek(fp, pos, SEEK_SET);
+    fput(fp);
+
+    return wlen == len ? 0 : -EIO;
+}
+
+static int supercmd_print(const char *prefix, const char *msg)
+{
+    int rc = 0;
+    if (prefix) rc = supercmd_write_stdout(prefix, strlen(prefix));
+    if (!rc) rc = supercmd_write_stdout(msg, strlen(msg));
+    if (!rc) rc = supercmd_write_stdout("\n", 1);
+    return rc;
+}
+
+// The reply is already written, let the exec load the shell only to return the status.
+// The task must not exit here, this runs in the execve hook chain and has to return through it.
+static void supercmd_exit(char **__user u_filename_p, char **__user uargv, uintptr_t *sp, int code)
+{
+    supercmd_exec(u_filename_p, sh_path, sp);
+
+    const char *__user cmd = supercmd_str_to_user_sp(sh_path, sp);
+    const char *__user opt = supercmd_str_to_user_sp("-c", sp);
+    const char *__user script = supercmd_str_to_user_sp(code ? "exit 1" : "exit 0", sp);
 
     set_user_arg_ptr(0, *uargv, 0, (uintptr_t)cmd);
-    set_user_arg_ptr(0, *uargv, 1, (uintptr_t)argv1);
-    set_user_arg_ptr(0, *uargv, 2, 0);
+    set_user_arg_ptr(0, *uargv, 1, (uintptr_t)opt);
+    set_user_arg_ptr(0, *uargv, 2, (uintptr_t)script);
+    set_user_arg_ptr(0, *uargv, 3, 0);
+}
+
+static void supercmd_reply(char **__user u_filename_p, char **__user uargv, uintptr_t *sp, struct cmd_res *cmd_res)
+{
+    char code[16];
+    int rc = 0;
+    if (cmd_res->rc) sprintf(code, "%d", cmd_res->rc);
+
+    if (cmd_res->msg && !rc) rc = supercmd_print(0, cmd_res->msg);
+    if (cmd_res->rc && !rc) rc = supercmd_print("supercmd error code: ", code);
+    if (cmd_res->err_msg && !rc) rc = supercmd_print("supercmd error message: ", cmd_res->err_msg);
+
+    if (!rc) {
+        supercmd_exit(u_filename_p, uargv, sp, cmd_res->rc || cmd_res->err_msg);
+        return;
+    }
+
+    // no direct write, let echo print it
+    if (cmd_res->msg) supercmd_echo(u_filename_p, uargv, sp, 0, cmd_res->msg);
+    if (cmd_res->rc) supercmd_echo(u_filename_p, uargv, sp, "supercmd error code:", code);
+    if (cmd_res->err_msg) supercmd_echo(u_filename_p, uargv, sp, "supercmd error message:", cmd_res->err_msg);
+}
+
+struct supercmd_entry
+{
+    const char *name;
+    int id;
+};
+
+// table must be sorted by name, -1 if not found
+static int supercmd_lookup(const struct supercmd_entry *table, int num, const char *name)
+{
+    if (!name) return -1;
+    int lo = 0, hi = num - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        int c = strcmp(name, table[mid].name);
+        if (!c) return table[mid].id;
+        if (c < 0) {
+            hi = mid - 1;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return -1;
 }
 
+#define supercmd_table_lookup(table, name) supercmd_lookup(table, sizeof(table) / sizeof(table[0]), name)
+
+enum
+{
+    CMD_SHELL,
+    CMD_BOOTLOG,
+    CMD_BUILDTIME,
+    CMD_EVENT,
+    CMD_EXEC,
+    CMD_HELP,
+    CMD_KEY,
+    CMD_MODULE,
+    CMD_STAGE,
+    CMD_SUMGR,
+    CMD_TEST,
+    CMD_VERSION,
+};
+
+static const struct supercmd_entry cmd_table[] = {
+    { "-c", CMD_SHELL },       { "bootlog", CMD_BOOTLOG }, { "buildtime", CMD_BUILDTIME }, { "event", CMD_EVENT },
+    { "exec", CMD_EXEC },      { "help", CMD_HELP },       { "key", CMD_KEY },             { "module", CMD_MODULE },
+    { "stage", CMD_STAGE },    { "sumgr", CMD_SUMGR },     { "test", CMD_TEST },           { "version", CMD_VERSION },
+};
+
+enum
+{
+    SUMGR_EXCLUDE,
+    SUMGR_EXCLUDE_LIST,
+    SUMGR_GRANT,
+    SUMGR_LIST,
+    SUMGR_NUM,
+    SUMGR_PATH,
+    SUMGR_PROFILE,
+    SUMGR_REVOKE,
+    SUMGR_SCTX,
+};
+
+static const struct supercmd_entry sumgr_table[] = {
+#ifdef ANDROID
+    { "exclude", SUMGR_EXCLUDE },
+    { "exclude_list", SUMGR_EXCLUDE_LIST },
+#endif
+    { "grant", SUMGR_GRANT },
+    { "list", SUMGR_LIST },
+    { "num", SUMGR_NUM },
+    { "path", SUMGR_PATH },
+    { "profile", SUMGR_PROFILE },
+    { "revoke", SUMGR_REVOKE },
+    { "sctx", SUMGR_SCTX },
+};
+
+enum
+{
+    MODULE_CTL0,
+    MODULE_CTL1,
+    MODULE_INFO,
+    MODULE_LIST,
+    MODULE_LOAD,
+    MODULE_NUM,
+    MODULE_UNLOAD,
+};
+
+static const struct supercmd_entry module_table[] = {
+    { "ctl0", MODULE_CTL0 }, { "ctl1", MODULE_CTL1 }, { "info", MODULE_INFO },     { "list", MODULE_LIST },
+    { "load", MODULE_LOAD }, { "num", MODULE_NUM },   { "unload", MODULE_UNLOAD },
+};
+
+enum
+{
+    KEY_GET,
+    KEY_HASH,
+    KEY_SET,
+};
+
+static const struct supercmd_entry key_table[] = {
+    { "get", KEY_GET },
+    { "hash", KEY_HASH },
+    { "set", KEY_SET },
+};
+
 static const char supercmd_help[] =
     ""
     "KernelPatch supercmd:\n"
@@ -78,8 +255,9 @@ static const char supercmd_help[] =
     "      grant <UID> [TO_UID [SCONTEXT]]  Grant su permission to UID.\n"
     "      revoke                           Revoke su permission to UID.\n"
     "      num                              Get the number of uids with the aforementioned permissions.\n"
-    "      list                             List all su allowed uids.\n"
-    "      profile <UID>                    Get the profile of the uid configuration.\n"
+    "      list [profile] [bin]             List all su allowed uids, or their full profiles.\n"
+    "                                       bin writes raw uid_t or struct su_profile records.\n"
+    "      profile <UID> [bin]              Get the profile of the uid configuration, bin as a raw struct su_profile.\n"
     "      path [PATH]                      Get or Reset current su path. The length of PATH must 2-127.\n"
     "      sctx [SCONTEXT]                  Get or Reset current all allowed security context.\n"
 #ifdef ANDROID
@@ -87,6 +265,7 @@ static const char supercmd_help[] =
     "      exclude <UID> [1|0]              Get or Reset exclude policy for UID.\n"
 #endif
     "  event <EVENT>                        Report EVENT.\n"
+    "  stage <STAGE> [PATH [...]]           Report boot STAGE, execute PATH only if a handler requires userspace.\n"
     "\n"
     "The command below requires superkey authentication.\n"
     "  module <SubCommand> [...]:   KernelPatch Module manager\n"
@@ -103,20 +282,15 @@ static const char supercmd_help[] =
     "      hash <enable|disable>:           Whether to use hash to verify the root superkey.\n"
     "";
 
-struct cmd_res
-{
-    const char *msg;
-    const char *err_msg;
-    int rc;
-};
+// records per su_allow_list_from call of sumgr list
+#define SUMGR_LIST_CHUNK 4
 
-static void handle_cmd_sumgr(char **__user u_filename_p, const char **carr, char *buffer, int buflen,
+// not inlined, the chunk is only on the stack while sumgr runs
+static __noinline void handle_cmd_sumgr(char **__user u_filename_p, const char **carr, char *buffer, int buflen,
                              struct cmd_res *cmd_res)
 {
-    const char *sub_cmd = carr[1];
-    if (!sub_cmd) sub_cmd = "";
-
-    if (!strcmp(sub_cmd, "grant")) {
+    switch (supercmd_table_lookup(sumgr_table, carr[1])) {
+    case SUMGR_GRANT: {
         unsigned long long uid = 0, to_uid = 0;
         const char *scontext = "";
         if (!carr[2] || kstrtoull(carr[2], 10, &uid)) {
@@ -129,7 +303,9 @@ static void handle_cmd_sumgr(char **__user u_filename_p, const char **carr, char
         su_add_allow_uid(uid, to_uid, scontext);
         sprintf(buffer, "grant %d, %d, %s", uid, to_uid, scontext);
         cmd_res->msg = buffer;
-    } else if (!strcmp(sub_cmd, "revoke")) {
+        break;
+    }
+    case SUMGR_REVOKE: {
         const char *suid = carr[2];
         unsigned long long uid;
         if (!suid || kstrtoull(suid, 10, &uid)) {
@@ -139,22 +315,56 @@ static void handle_cmd_sumgr(char **__user u_filename_p, const char **carr, char
         }
         su_remove_allow_uid(uid);
         cmd_res->msg = suid;
-    } else if (!strcmp(sub_cmd, "num")) {
+        break;
+    }
+    case SUMGR_NUM: {
         int num = su_allow_uid_nums();
         sprintf(buffer, "%d", num);
         cmd_res->msg = buffer;
-    } else if (!strcmp(sub_cmd, "list")) {
-        uid_t uids[128]; // default max size 128
+        break;
+    }
+    case SUMGR_LIST: {
+        int flags = 0, bin = 0;
+        for (int i = 2; i < 4 && carr[i]; i++) {
+            if (!strcmp(carr[i], "profile")) flags = SU_LIST_FLAG_PROFILE;
+            if (!strcmp(carr[i], "bin")) bin = 1;
+        }
+        int esize = flags ? sizeof(struct su_profile) : sizeof(uid_t);
+        // records are taken a chunk at a time, entries added or removed meanwhile may be missed or repeated
+        struct su_profile chunk[SUMGR_LIST_CHUNK];
+        int cap = sizeof(chunk) / esize;
         int offset = 0;
         buffer[0] = '\0';
-        int num = su_allow_uids(0, uids, sizeof(uids) / sizeof(uids[0]));
-        for (int i = 0; i < num; i++) {
-            offset += sprintf(buffer + offset, "%d\n", uids[i]);
-        };
+        for (int start = 0;; start += cap) {
+            int total = su_allow_list_from(start, chunk, cap, flags);
+            if (total < 0) {
+                cmd_res->rc = total;
+                return;
+            }
+            int num = total - start < cap ? total - start : cap;
+            if (num <= 0) break;
+            if (bin) {
+                cmd_res->rc = supercmd_write_stdout((const char *)chunk, num * esize);
+                if (cmd_res->rc) return;
+                continue;
+            }
+            for (int i = 0; i < num && offset < buflen; i++) {
+                if (flags) {
+                    offset += snprintf(buffer + offset, buflen - offset, "%d %d %s\n", chunk[i].uid, chunk[i].to_uid,
+                                       chunk[i].scontext);
+                } else {
+                    offset += snprintf(buffer + offset, buflen - offset, "%d\n", ((uid_t *)chunk)[i]);
+                }
+            }
+            if (offset >= buflen) break;
+        }
+        if (bin) return;
+        if (offset > buflen) offset = buflen;
         if (offset > 0) buffer[offset - 1] = '\0';
         cmd_res->msg = buffer;
-
-    } else if (!strcmp(sub_cmd, "profile")) {
+        break;
+    }
+    case SUMGR_PROFILE: {
         unsigned long long uid;
         if (!carr[2] || kstrtoull(carr[2], 10, &uid)) {
             cmd_res->err_msg = "invalid uid";
@@ -164,28 +374,40 @@ static void handle_cmd_sumgr(char **__user u_filename_p, const char **carr, char
         cmd_res->rc = su_allow_uid_profile(0, uid, &profile);
         if (cmd_res->rc) return;
 
+        if (carr[3] && !strcmp(carr[3], "bin")) {
+            cmd_res->rc = supercmd_write_stdout((const char *)&profile, sizeof(profile));
+            return;
+        }
         sprintf(buffer, "uid: %d, to_uid: %d, scontext: %s", profile.uid, profile.to_uid, profile.scontext);
         cmd_res->msg = buffer;
-
-    } else if (!strcmp(sub_cmd, "path")) {
+        break;
+    }
+    case SUMGR_PATH: {
         if (carr[2]) {
             cmd_res->rc = su_reset_path(carr[2]);
             if (cmd_res->rc) return;
             cmd_res->msg = carr[2];
-            carr[2] = 0; // no free
         } else {
-            cmd_res->msg = su_get_path();
+            int len = su_get_path_copy(buffer, buflen);
+            if (len < 0) {
+                cmd_res->rc = len;
+                return;
+            }
+            cmd_res->msg = buffer;
         }
-    } else if (!strcmp(sub_cmd, "sctx")) {
+        break;
+    }
+    case SUMGR_SCTX: {
         if (carr[2]) {
             cmd_res->rc = set_all_allow_sctx(carr[2]);
             if (!cmd_res->rc) cmd_res->msg = carr[2];
         } else {
             cmd_res->msg = all_allow_sctx;
         }
+        break;
     }
 #ifdef ANDROID
-    else if (!strcmp(sub_cmd, "exclude")) {
+    case SUMGR_EXCLUDE: {
         unsigned long long uid;
         if (!carr[2] || kstrtoull(carr[2], 10, &uid)) {
             cmd_res->err_msg = "invalid uid";
@@ -205,7 +427,9 @@ static void handle_cmd_sumgr(char **__user u_filename_p, const char **carr, char
                 }
             }
         }
-    } else if (!strcmp(sub_cmd, "exclude_list")) {
+        break;
+    }
+    case SUMGR_EXCLUDE_LIST: {
         uid_t uids[128];
         int offset = 0;
         buffer[0] = '\0';
@@ -219,23 +443,24 @@ static void handle_cmd_sumgr(char **__user u_filename_p, const char **carr, char
             if (offset > 0) buffer[offset - 1] = '\0';
             cmd_res->msg = buffer;
         }
+        break;
     }
 #endif
-    else {
+    default:
         cmd_res->err_msg = "invalid subcommand";
     }
 }
 
 // superkey commands
-static void handle_cmd_key_auth(char **__user u_filename_p, const char *cmd, const char **carr, char *buffer,
-                                int buflen, struct cmd_res *cmd_res)
+static void handle_cmd_key_auth(char **__user u_filename_p, int cmd, const char **carr, char *buffer, int buflen,
+                                struct cmd_res *cmd_res)
 {
-    if (!strcmp("key", cmd)) {
-        const char *sub_cmd = carr[1];
-        if (!sub_cmd) sub_cmd = "";
-        if (!strcmp("get", sub_cmd)) {
+    if (cmd == CMD_KEY) {
+        switch (supercmd_table_lookup(key_table, carr[1])) {
+        case KEY_GET:
             cmd_res->msg = get_superkey();
-        } else if (!strcmp("set", sub_cmd)) {
+            break;
+        case KEY_SET: {
             const char *key = carr[2];
             if (!key) {
                 cmd_res->err_msg = "invalid new key";
@@ -243,7 +468,9 @@ static void handle_cmd_key_auth(char **__user u_filename_p, const char *cmd, con
             }
             cmd_res->msg = key;
             reset_superkey(key);
-        } else if (!strcmp("hash", sub_cmd)) {
+            break;
+        }
+        case KEY_HASH: {
             const char *able = carr[2];
             if (able && !strcmp("enable", able)) {
                 cmd_res->msg = able;
@@ -255,21 +482,25 @@ static void handle_cmd_key_auth(char **__user u_filename_p, const char *cmd, con
                 cmd_res->err_msg = "invalid enable or disable";
                 return;
             }
-        } else {
+            break;
+        }
+        default:
             cmd_res->err_msg = "invalid subcommand";
             return;
         }
-    } else if (!strcmp("module", cmd)) {
-        const char *sub_cmd = carr[1];
-        if (!sub_cmd) sub_cmd = "";
-        if (!strcmp("num", sub_cmd)) {
+    } else if (cmd == CMD_MODULE) {
+        switch (supercmd_table_lookup(module_table, carr[1])) {
+        case MODULE_NUM: {
             int num = get_module_nums();
             sprintf(buffer, "%d\n", num);
             cmd_res->msg = buffer;
-        } else if (!strcmp("list", sub_cmd)) {
+            break;
+        }
+        case MODULE_LIST:
             list_modules(buffer, buflen);
             cmd_res->msg = buffer;
-        } else if (!strcmp("load", sub_cmd)) {
+            break;
+        case MODULE_LOAD: {
             const char *path = carr[2];
             if (!path) {
                 cmd_res->err_msg = "invalid module path";
@@ -277,7 +508,9 @@ static void handle_cmd_key_auth(char **__user u_filename_p, const char *cmd, con
             }
             cmd_res->rc = load_module_path(path, carr[3], 0);
             if (!cmd_res->rc) cmd_res->msg = path;
-        } else if (!strcmp("ctl0", sub_cmd)) {
+            break;
+        }
+        case MODULE_CTL0: {
             const char *name = carr[2];
             if (!name) {
                 cmd_res->err_msg = "invalid module name";
@@ -291,9 +524,12 @@ static void handle_cmd_key_auth(char **__user u_filename_p, const char *cmd, con
             buffer[0] = '\0';
             cmd_res->rc = module_control0(name, mod_args, buffer, buflen);
             cmd_res->msg = buffer;
-        } else if (!strcmp("ctl1", sub_cmd)) {
+            break;
+        }
+        case MODULE_CTL1:
             cmd_res->err_msg = "not implement";
-        } else if (!strcmp("unload", sub_cmd)) {
+            break;
+        case MODULE_UNLOAD: {
             const char *name = carr[2];
             if (!name) {
                 cmd_res->err_msg = "invalid module name";
@@ -301,7 +537,9 @@ static void handle_cmd_key_auth(char **__user u_filename_p, const char *cmd, con
             }
             cmd_res->rc = unload_module(name, 0);
             if (!cmd_res->rc) cmd_res->msg = name;
-        } else if (!strcmp("info", sub_cmd)) {
+            break;
+        }
+        case MODULE_INFO: {
             const char *name = carr[2];
             if (!name) {
                 cmd_res->err_msg = "invalid module name";
@@ -310,7 +548,9 @@ static void handle_cmd_key_auth(char **__user u_filename_p, const char *cmd, con
             int sz = get_module_info(name, buffer, buflen);
             if (sz <= 0) cmd_res->rc = sz;
             cmd_res->msg = buffer;
-        } else {
+            break;
+        }
+        default:
             cmd_res->err_msg = "invalid subcommand";
             return;
         }
@@ -320,13 +560,63 @@ static void handle_cmd_key_auth(char **__user u_filename_p, const char *cmd, con
     }
 }
 
+#define SUPERCMD_ARGS_NO 16
+#define SUPERCMD_ARG_MAX_LEN 512
+// one stack buffer, reply text first, argument strings in the tail
+#define SUPERCMD_BUF_LEN 4096
+#define SUPERCMD_ARGS_BUF_LEN 1024
+#define SUPERCMD_MSG_LEN (SUPERCMD_BUF_LEN - SUPERCMD_ARGS_BUF_LEN)
+
+// one bounded string copy per argument into arena, parr from index 2, stops after -c
+static void supercmd_copy_arg_strings(const char __user **uptrs, const char **parr, char *arena, int arena_len)
+{
+    if (!uptrs[0] || !uptrs[1]) return;
+
+    int off = 0;
+    for (int i = 2; i < SUPERCMD_ARGS_NO; i++) {
+        const char __user *ua = uptrs[i];
+        if (!ua) break;
+        int left = arena_len - off;
+        if (left <= 1) break;
+        char *a = arena + off;
+        long len = compat_strncpy_from_user(a, ua, left < SUPERCMD_ARG_MAX_LEN ? left : SUPERCMD_ARG_MAX_LEN);
+        if (len <= 0) break;
+        parr[i] = a;
+        off += len;
+        // ignore after -c
+        if (a[0] == '-' && a[1] == 'c') break;
+    }
+}
+
+// one copy for argv[0, SUPERCMD_ARGS_NO), entries after the first NULL are not meaningful
+static void supercmd_copy_arg_ptrs(const void __user *uargv, const char __user **uptrs)
+{
+    int cplen = compat_copy_from_user(uptrs, uargv, SUPERCMD_ARGS_NO * sizeof(uptrs[0]));
+    int num = cplen > 0 ? cplen / sizeof(uptrs[0]) : 0;
+    for (int i = 0; i < num; i++) {
+        if (!uptrs[i]) {
+            num = SUPERCMD_ARGS_NO;
+            break;
+        }
+    }
+    // the array may end just before an unmapped page
+    for (int i = num; i < SUPERCMD_ARGS_NO; i++) {
+        const char __user *ua = get_user_arg_ptr(0, (void *)uargv, i);
+        uptrs[i] = IS_ERR(ua) ? 0 : ua;
+        if (!uptrs[i]) break;
+    }
+}
+
 void handle_supercmd(char **__user u_filename_p, char **__user uargv)
 {
     int is_key_auth = 0;
 
+    const char __user *uptrs[SUPERCMD_ARGS_NO] = { 0 };
+    supercmd_copy_arg_ptrs((void *)*uargv, uptrs);
+
     // key
-    const char __user *p1 = get_user_arg_ptr(0, *uargv, 1);
-    if (!p1 || IS_ERR(p1)) return;
+    const char __user *p1 = uptrs[1];
+    if (!p1 || !uptrs[0]) return;
 
     struct su_profile profile = { .to_uid = 0, .scontext = "" };
 
@@ -344,22 +634,13 @@ void handle_supercmd(char **__user u_filename_p, char **__user uargv)
         return;
     }
 
-#define SUPERCMD_ARGS_NO 16
-
     // copy args
+    char buffer[SUPERCMD_BUF_LEN];
     const char *parr[SUPERCMD_ARGS_NO + 4] = { 0 };
-
-    for (int i = 2; i < SUPERCMD_ARGS_NO; i++) {
-        const char __user *ua = get_user_arg_ptr(0, *uargv, i);
-        if (IS_ERR(ua)) break;
-        const char *a = strndup_user(ua, 512);
-        if (IS_ERR(a)) break;
-        parr[i] = a;
-        // ignore after -c
-        if (a[0] == '-' && a[1] == 'c') break;
-    }
+    supercmd_copy_arg_strings(uptrs, parr, buffer + SUPERCMD_MSG_LEN, SUPERCMD_ARGS_BUF_LEN);
 
     uint64_t sp = current_user_stack_pointer();
+    struct cmd_res cmd_res = { 0 };
 
     // if no any more
     if (!parr[2]) {
@@ -388,8 +669,8 @@ void handle_supercmd(char **__user u_filename_p, char **__user uargv)
                 kstrtoull(parr[pi++], 10, &to_uid);
                 profile.to_uid = to_uid;
             } else {
-                supercmd_echo(u_filename_p, uargv, &sp, "supercmd error: invalid to_uid");
-                goto free;
+                cmd_res.err_msg = "invalid to_uid";
+                goto echo;
             }
             break;
         case 'Z':
@@ -397,8 +678,8 @@ void handle_supercmd(char **__user u_filename_p, char **__user uargv)
                 strncpy(profile.scontext, parr[pi++], sizeof(profile.scontext) - 1);
                 profile.scontext[sizeof(profile.scontext) - 1] = '\0';
             } else {
-                supercmd_echo(u_filename_p, uargv, &sp, "supercmd error: invalid scontext\n");
-                goto free;
+                cmd_res.err_msg = "invalid scontext";
+                goto echo;
             }
             break;
         default:
@@ -408,9 +689,6 @@ void handle_supercmd(char **__user u_filename_p, char **__user uargv)
 
     commit_su(profile.to_uid, profile.scontext);
 
-    struct cmd_res cmd_res = { 0 };
-
-    char buffer[4096];
     buffer[0] = '\0';
 
     // command
@@ -427,62 +705,74 @@ void handle_supercmd(char **__user u_filename_p, char **__user uargv)
     if (!cmd) {
         supercmd_exec(u_filename_p, sh_path, &sp);
         *uargv += pi * 8;
-        goto free;
+        return;
     }
 
-    if (!strcmp("help", cmd)) {
+    int cmd_id = supercmd_table_lookup(cmd_table, cmd);
+    switch (cmd_id) {
+    case CMD_HELP:
         cmd_res.msg = supercmd_help;
-    } else if (!strcmp("-c", cmd)) {
+        break;
+    case CMD_SHELL:
         supercmd_exec(u_filename_p, sh_path, &sp);
         *uargv += (carr - parr - 1) * 8;
-        goto free;
-    } else if (!strcmp("exec", cmd)) {
+        return;
+    case CMD_EXEC:
         if (!carr[1]) {
             cmd_res.err_msg = "invalid commmand path";
-            goto echo;
+            break;
         }
         supercmd_exec(u_filename_p, carr[1], &sp);
         *uargv += (carr - parr + 1) * 8;
-        goto free;
-    } else if (!strcmp("version", cmd)) {
-        supercmd_echo(u_filename_p, uargv, &sp, "%x,%x", kver, kpver);
-        goto free;
-    } else if (!strcmp("buildtime", cmd)) {
+        return;
+    case CMD_VERSION:
+        sprintf(buffer, "%x,%x", kver, kpver);
+        cmd_res.msg = buffer;
+        break;
+    case CMD_BUILDTIME:
         cmd_res.msg = get_build_time();
-        goto echo;
-    } else if (!strcmp("sumgr", cmd)) {
-        handle_cmd_sumgr(u_filename_p, carr, buffer, sizeof(buffer), &cmd_res);
-    } else if (!strcmp("event", cmd)) {
+        break;
+    case CMD_SUMGR:
+        handle_cmd_sumgr(u_filename_p, carr, buffer, SUPERCMD_MSG_LEN, &cmd_res);
+        break;
+    case CMD_EVENT:
         if (carr[1]) {
-            cmd_res.rc = report_user_event(carr[1], carr[2]);
-            if (!cmd_res.rc) cmd_res.msg = "report success";
+            report_user_event(carr[1], carr[2]);
+            cmd_res.msg = "report success";
         } else {
             cmd_res.err_msg = "empty event";
         }
-    } else if (!strcmp("bootlog", cmd)) {
+        break;
+    case CMD_STAGE:
+        if (!carr[1]) {
+            cmd_res.err_msg = "empty stage";
+            break;
+        }
+        // exec PATH only if some handler needs userspace for this stage
+        if (report_user_event(carr[1], 0) == USER_EVENT_RUN_USER && carr[2]) {
+            supercmd_exec(u_filename_p, carr[2], &sp);
+            *uargv += (carr - parr + 2) * 8;
+            return;
+        }
+        cmd_res.msg = carr[1];
+        break;
+    case CMD_BOOTLOG:
         cmd_res.msg = get_boot_log();
-    } else if (!strcmp("test", cmd)) {
+        break;
+    case CMD_TEST: {
         void test();
         test();
         cmd_res.msg = "test done...";
-    } else {
+        break;
+    }
+    default:
         if (is_key_auth) {
-            handle_cmd_key_auth(u_filename_p, cmd, carr, buffer, sizeof(buffer), &cmd_res);
+            handle_cmd_key_auth(u_filename_p, cmd_id, carr, buffer, SUPERCMD_MSG_LEN, &cmd_res);
         } else {
             cmd_res.err_msg = "invalid command or a superkey is required";
         }
     }
 
 echo:
-    if (cmd_res.msg) supercmd_echo(u_filename_p, uargv, &sp, cmd_res.msg);
-    if (cmd_res.rc) supercmd_echo(u_filename_p, uargv, &sp, "supercmd error code: %d", cmd_res.rc);
-    if (cmd_res.err_msg) supercmd_echo(u_filename_p, uargv, &sp, "supercmd error message: %s", cmd_res.err_msg);
-
-free:
-    // free args
-    for (int i = 2; i < sizeof(parr) / sizeof(parr[0]); i++) {
-        const char *a = parr[i];
-        if (!a) continue;
-        kfree(a);
-    }
+    supercmd_reply(u_filename_p, uargv, &sp, &cmd_res);
 }
@@ -33,6 +33,9 @@ KP_EXPORT_SYMBOL(has_syscall_wrapper);
 int has_config_compat = 0;
 KP_EXPORT_SYMBOL(has_config_compat);
 
+extern int kfunc_def(kallsyms_lookup_size_offset)(unsigned long addr, unsigned long *symbolsize,
+                                                  unsigned long *offset);
+
 struct user_arg_ptr
 {
     union
@@ -61,16 +64,16 @@ const char __user *get_user_arg_ptr(void *a0, void *a1, int nr)
         if (a0) size = 4; // compat
     }
     native = (char __user *const __user *)((unsigned long)native + nr * size);
-    char __user **upptr = memdup_user(native, size);
-    if (IS_ERR(upptr)) return ERR_PTR((long)upptr);
+    uint64_t val = 0;
+    int cplen = compat_copy_from_user(&val, native, size);
+    if (cplen <= 0) return ERR_PTR(cplen ?: -EFAULT);
 
     char __user *uptr;
     if (size == 8) {
-        uptr = *upptr;
+        uptr = (char __user *)val;
     } else {
-        uptr = (char __user *)(unsigned long)*(int32_t *)upptr;
+        uptr = (char __user *)(unsigned long)(int32_t)val;
     }
-    kfree(upptr);
     return uptr;
 }
 
@@ -153,9 +156,71 @@ uintptr_t syscalln_addr(int nr, int is_compat)
 }
 KP_EXPORT_SYMBOL(syscalln_addr);
 
+#define SYSCALL_HANDLER_NUM (sizeof(syscall_name_table) / sizeof(syscall_name_table[0]))
+// resolved, but no such symbol
+#define SYSCALL_HANDLER_NONE ((uintptr_t)1)
+
+// sys_call_table if its size is known, read live so that fp hooks are still honored, never written here.
+static uintptr_t *syscall_table = 0;
+// Entries of syscall_table, or of syscall_handler_cache without it.
+static long syscall_handler_num = SYSCALL_HANDLER_NUM;
+// Native handlers resolved by name.
+static uintptr_t syscall_handler_cache[SYSCALL_HANDLER_NUM] = { 0 };
+
+static inline uintptr_t raw_syscall_addr(long nr)
+{
+    if (unlikely(nr < 0 || nr >= syscall_handler_num)) return 0;
+    if (syscall_table) return syscall_table[nr];
+    uintptr_t addr = syscall_handler_cache[nr];
+    if (likely(addr > SYSCALL_HANDLER_NONE)) return addr;
+    if (addr == SYSCALL_HANDLER_NONE) return 0;
+    // symbol lookups are too slow to do for every syscall at init, resolve once on first use
+    addr = syscalln_name_addr(nr, 0);
+    syscall_handler_cache[nr] = addr ?: SYSCALL_HANDLER_NONE;
+    return addr;
+}
+
+// The kernel's __NR_syscalls is not exported, take it from the symbol size of sys_call_table,
+// which spans to the next symbol, so trailing padding is dropped.
+static long syscall_table_num()
+{
+    if (!sys_call_table || !kfunc(kallsyms_lookup_size_offset)) return 0;
+    unsigned long size = 0, offset = 0;
+    if (!kfunc(kallsyms_lookup_size_offset)((unsigned long)sys_call_table, &size, &offset) || offset) return 0;
+    long num = size / sizeof(uintptr_t);
+    while (num > 0 && !sys_call_table[num - 1]) num--;
+    return num;
+}
+
+static inline long raw_syscall_call(uintptr_t addr, struct pt_regs *regs)
+{
+    if (has_syscall_wrapper) return ((warp_raw_syscall_f)addr)(regs);
+    return ((raw_syscall6_f)addr)(regs->regs[0], regs->regs[1], regs->regs[2], regs->regs[3], regs->regs[4],
+                                  regs->regs[5]);
+}
+
+int raw_syscall_ctx_init(struct raw_syscall_ctx *ctx, long nr)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->addr = raw_syscall_addr(nr);
+    if (!ctx->addr) return -ENOSYS;
+    ctx->regs.syscallno = nr;
+    ctx->regs.regs[8] = nr;
+    return 0;
+}
+KP_EXPORT_SYMBOL(raw_syscall_ctx_init);
+
+long raw_syscall_ctx_call(struct raw_syscall_ctx *ctx)
+{
+    if (unlikely(!ctx->addr)) return -ENOSYS;
+    return raw_syscall_call(ctx->addr, &ctx->regs);
+}
+KP_EXPORT_SYMBOL(raw_syscall_ctx_call);
+
 long raw_syscall0(long nr)
 {
-    uintptr_t addr = syscalln_addr(nr, 0);
+    uintptr_t addr = raw_syscall_addr(nr);
+    if (unlikely(!addr)) return -ENOSYS;
     if (has_syscall_wrapper) {
         struct pt_regs regs;
         regs.syscallno = nr;
@@ -168,7 +233,8 @@ KP_EXPORT_SYMBOL(raw_syscall0);
 
 long raw_syscall1(long nr, long arg0)
 {
-    uintptr_t addr = syscalln_addr(nr, 0);
+    uintptr_t addr = raw_syscall_addr(nr);
+    if (unlikely(!addr)) return -ENOSYS;
     if (has_syscall_wrapper) {
         struct pt_regs regs;
         regs.syscallno = nr;
@@ -182,7 +248,8 @@ KP_EXPORT_SYMBOL(raw_syscall1);
 
 long raw_syscall2(long nr, long arg0, long arg1)
 {
-    uintptr_t addr = syscalln_addr(nr, 0);
+    uintptr_t addr = raw_syscall_addr(nr);
+    if (unlikely(!addr)) return -ENOSYS;
     if (has_syscall_wrapper) {
         struct pt_regs regs;
         regs.syscallno = nr;
@@ -197,7 +264,8 @@ KP_EXPORT_SYMBOL(raw_syscall2);
 
 long raw_syscall3(long nr, long arg0, long arg1, long arg2)
 {
-    uintptr_t addr = syscalln_addr(nr, 0);
+    uintptr_t addr = raw_syscall_addr(nr);
+    if (unlikely(!addr)) return -ENOSYS;
     if (has_syscall_wrapper) {
         struct pt_regs regs;
         regs.syscallno = nr;
@@ -213,7 +281,8 @@ KP_EXPORT_SYMBOL(raw_syscall3);
 
 long raw_syscall4(long nr, long arg0, long arg1, long arg2, long arg3)
 {
-    uintptr_t addr = syscalln_addr(nr, 0);
+    uintptr_t addr = raw_syscall_addr(nr);
+    if (unlikely(!addr)) return -ENOSYS;
     if (has_syscall_wrapper) {
         struct pt_regs regs;
         regs.syscallno = nr;
@@ -230,7 +299,8 @@ KP_EXPORT_SYMBOL(raw_syscall4);
 
 long raw_syscall5(long nr, long arg0, long arg1, long arg2, long arg3, long arg4)
 {
-    uintptr_t addr = syscalln_addr(nr, 0);
+    uintptr_t addr = raw_syscall_addr(nr);
+    if (unlikely(!addr)) return -ENOSYS;
     if (has_syscall_wrapper) {
         struct pt_regs regs;
         regs.syscallno = nr;
@@ -248,7 +318,8 @@ KP_EXPORT_SYMBOL(raw_syscall5);
 
 long raw_syscall6(long nr, long arg0, long arg1, long arg2, long arg3, long arg4, long arg5)
 {
-    uintptr_t addr = syscalln_addr(nr, 0);
+    uintptr_t addr = raw_syscall_addr(nr);
+    if (unlikely(!addr)) return -ENOSYS;
     if (has_syscall_wrapper) {
         struct pt_regs regs;
         regs.syscallno = nr;
@@ -378,6 +449,14 @@ void syscall_init()
         }
     }
 
+    // without a known size sys_call_table is not indexed, handlers are resolved by name
+    long num = syscall_table_num();
+    if (num) {
+        syscall_table = sys_call_table;
+        syscall_handler_num = num;
+    }
+    log_boot("syscall handlers: %d, from table: %d\n", syscall_handler_num, !!syscall_table);
+
     log_boot("syscall config_compat: %d\n", has_config_compat);
     log_boot("syscall has_wrapper: %d\n", has_syscall_wrapper);
 }
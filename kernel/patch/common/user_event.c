@@ -6,9 +6,113 @@
 #include <user_event.h>
 
 #include <log.h>
+#include <ktypes.h>
+#include <symbol.h>
+#include <linux/spinlock.h>
+#include <linux/delay.h>
+#include <uapi/asm-generic/errno.h>
+
+struct user_event_handler
+{
+    user_event_handler_t handler;
+    void *udata;
+    int calls; // reports running the handler, the slot is not reused before they return
+};
+
+static struct user_event_handler handlers[USER_EVENT_HANDLER_MAX] = { 0 };
+static spinlock_t handlers_lock;
+
+int add_user_event_handler(user_event_handler_t handler, void *udata)
+{
+    if (!handler) return -EINVAL;
+    int rc = -ENOSPC;
+    spin_lock(&handlers_lock);
+    for (int i = 0; i < USER_EVENT_HANDLER_MAX; i++) {
+        if (!handlers[i].handler && !handlers[i].calls) {
+            handlers[i].udata = udata;
+            handlers[i].handler = handler;
+            rc = 0;
+            break;
+        }
+    }
+    spin_unlock(&handlers_lock);
+    return rc;
+}
+KP_EXPORT_SYMBOL(add_user_event_handler);
+
+// Clear the slots matching, then sleep until the reports already running them return.
+static void remove_handlers(int (*match)(struct user_event_handler *h, void *data), void *data)
+{
+    int removed[USER_EVENT_HANDLER_MAX] = { 0 };
+    spin_lock(&handlers_lock);
+    for (int i = 0; i < USER_EVENT_HANDLER_MAX; i++) {
+        if (!handlers[i].handler || !match(&handlers[i], data)) continue;
+        handlers[i].handler = 0;
+        handlers[i].udata = 0;
+        removed[i] = 1;
+    }
+    spin_unlock(&handlers_lock);
+
+    for (int i = 0; i < USER_EVENT_HANDLER_MAX; i++) {
+        if (!removed[i]) continue;
+        while (*(volatile int *)&handlers[i].calls) {
+            kfunc_call_void(msleep, 1);
+        }
+    }
+}
+
+static int match_handler(struct user_event_handler *h, void *data)
+{
+    struct user_event_handler *target = (struct user_event_handler *)data;
+    return h->handler == target->handler && h->udata == target->udata;
+}
+
+void remove_user_event_handler(user_event_handler_t handler, void *udata)
+{
+    struct user_event_handler target = { .handler = handler, .udata = udata };
+    remove_handlers(match_handler, &target);
+}
+KP_EXPORT_SYMBOL(remove_user_event_handler);
+
+static int match_range(struct user_event_handler *h, void *data)
+{
+    uintptr_t *range = (uintptr_t *)data;
+    return (uintptr_t)h->handler >= range[0] && (uintptr_t)h->handler < range[1];
+}
+
+void remove_user_event_handlers_in(uintptr_t start, uintptr_t end)
+{
+    uintptr_t range[2] = { start, end };
+    remove_handlers(match_range, range);
+}
 
 int report_user_event(const char *event, const char *args)
 {
     logki("user report event: %s, args: %s\n", event, args);
-    return 0;
-}
\ No newline at end of file
+
+    // handlers may sleep, call them on a snapshot, counted so that remove can wait for them
+    struct user_event_handler snapshot[USER_EVENT_HANDLER_MAX];
+    spin_lock(&handlers_lock);
+    for (int i = 0; i < USER_EVENT_HANDLER_MAX; i++) {
+        snapshot[i] = handlers[i];
+        if (handlers[i].handler) handlers[i].calls++;
+    }
+    spin_unlock(&handlers_lock);
+
+    int ret = 0;
+    for (int i = 0; i < USER_EVENT_HANDLER_MAX; i++) {
+        if (!snapshot[i].handler) continue;
+        int rc = snapshot[i].handler(event, args, snapshot[i].udata);
+        if (rc == USER_EVENT_RUN_USER) ret = USER_EVENT_RUN_USER;
+        spin_lock(&handlers_lock);
+        handlers[i].calls--;
+        spin_unlock(&handlers_lock);
+    }
+    return ret;
+}
+KP_EXPORT_SYMBOL(report_user_event);
+
+void user_event_init()
+{
+    spin_lock_init(&handlers_lock);
+}
@@ -17,6 +17,8 @@
 #include <linux/random.h>
 #include <linux/sched.h>
 #include <linux/cred.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
 
 extern int kfunc_def(xt_data_to_user)(void __user *dst, const void *src, int usersize, int size, int aligned_size);
 
@@ -28,6 +30,9 @@ static inline int compat_xt_data_copy_to_user(void __user *dst, const void *src,
 extern int kfunc_def(bits_to_user)(unsigned long *bits, unsigned int maxbit, unsigned int maxlen, void __user *p,
                                    int compat);
 
+extern int kfunc_def(kallsyms_lookup_size_offset)(unsigned long addr, unsigned long *symbolsize,
+                                                  unsigned long *offset);
+
 static inline int compat_bits_copy_to_user(void __user *dst, const void *src, int size)
 {
     kfunc_direct_call(bits_to_user, (unsigned long *)src, size * sizeof(unsigned long), size, dst, 0);
@@ -35,7 +40,6 @@ static inline int compat_bits_copy_to_user(void __user *dst, const void *src, in
 
 __noinline int trace_seq_copy_to_user(void __user *to, const void *from, int n)
 {
-    // todo: n > page_size
     if (n > page_size) return 0;
 
     unsigned char trace_seq_data[page_size + 0x20];
@@ -53,6 +57,213 @@ __noinline int trace_seq_copy_to_user(void __user *to, const void *from, int n)
     return sz;
 }
 
+static int trace_seq_copy_to_user_chunked(void __user *to, const void *from, int n)
+{
+    int off = 0;
+    while (off < n) {
+        int len = n - off > page_size ? page_size : n - off;
+        int sz = trace_seq_copy_to_user(to + off, from + off, len);
+        if (sz <= 0) return off ?: sz;
+        off += sz;
+        if (sz < len) break;
+    }
+    return off;
+}
+
+#define ID_AA64MMFR1_PAN_SHIFT 20
+#define ID_AA64MMFR2_UAO_SHIFT 4
+#define TTBR_BADDR_MASK 0x0000fffffffffffeull
+#define TTBR_ASID_MASK (0xffffull << 48)
+#define TCR_T0SZ_MASK 0x3full
+// chunk size with user access opened, bounds the window user memory is exposed
+#define NATIVE_UACCESS_CHUNK (64 * 1024)
+
+static inline bool cpu_has_pan()
+{
+    uint64_t mmfr1;
+    asm volatile("mrs %0, id_aa64mmfr1_el1" : "=r"(mmfr1));
+    return (mmfr1 >> ID_AA64MMFR1_PAN_SHIFT) & 0xf;
+}
+
+// id_aa64mmfr2_el1, s3_0_c0_c7_2
+static inline bool cpu_has_uao()
+{
+    uint64_t mmfr2;
+    asm volatile("mrs %0, s3_0_c0_c7_2" : "=r"(mmfr2));
+    return (mmfr2 >> ID_AA64MMFR2_UAO_SHIFT) & 0xf;
+}
+
+// PSTATE.PAN, s3_0_c4_c2_3, needs no armv8.1 assembler support
+static inline uint64_t pan_save_clear()
+{
+    uint64_t pan;
+    asm volatile("mrs %0, s3_0_c4_c2_3" : "=r"(pan));
+    asm volatile("msr s3_0_c4_c2_3, xzr" ::: "memory");
+    return pan;
+}
+
+static inline void pan_restore(uint64_t pan)
+{
+    asm volatile("msr s3_0_c4_c2_3, %0" ::"r"(pan) : "memory");
+}
+
+// PSTATE.UAO, s3_0_c4_c2_4, set under KERNEL_DS before 5.11, then ldtr/sttr of the copy routine are privileged
+static inline uint64_t uao_save_clear()
+{
+    uint64_t uao;
+    asm volatile("mrs %0, s3_0_c4_c2_4" : "=r"(uao));
+    asm volatile("msr s3_0_c4_c2_4, xzr" ::: "memory");
+    return uao;
+}
+
+static inline void uao_restore(uint64_t uao)
+{
+    asm volatile("msr s3_0_c4_c2_4, %0" ::"r"(uao) : "memory");
+}
+
+// TASK_SIZE_64, the user va size programmed in TCR_EL1.T0SZ
+static inline uint64_t user_task_size()
+{
+    uint64_t tcr;
+    asm volatile("mrs %0, tcr_el1" : "=r"(tcr));
+    uint64_t t0sz = tcr & TCR_T0SZ_MASK;
+    if (t0sz < 12) t0sz = 12;
+    return 1ull << (64 - t0sz);
+}
+
+// CONFIG_ARM64_SW_TTBR0_PAN, user page table is switched out while in kernel
+static bool ttbr0_is_reserved()
+{
+    uint64_t ttbr0;
+    asm volatile("mrs %0, ttbr0_el1" : "=r"(ttbr0));
+    ttbr0 &= TTBR_BADDR_MASK;
+    if (kvar(reserved_ttbr0) && ttbr0 == kimg_to_phys((uint64_t)kvar(reserved_ttbr0))) return true;
+    if (kvar(reserved_pg_dir) && ttbr0 == kimg_to_phys((uint64_t)kvar(reserved_pg_dir))) return true;
+    return false;
+}
+
+/*
+ * thread_info->ttbr0, saved by the kernel on every switch to the task.
+ * It follows flags, and addr_limit before 5.11, addr_limit is USER_DS or KERNEL_DS, all ones in its low bits.
+ * A user page table always comes with a non zero asid, kernel threads have the reserved one.
+ */
+static uint64_t current_user_ttbr0()
+{
+    uint64_t *ti = (uint64_t *)current_thread_info();
+    uint64_t limit = ti[1];
+    uint64_t ttbr0 = (limit & (limit + 1)) ? ti[1] : ti[2];
+    if (!(ttbr0 & TTBR_ASID_MASK) || !(ttbr0 & TTBR_BADDR_MASK)) return 0;
+    return ttbr0;
+}
+
+typedef struct
+{
+    uint64_t ttbr0;
+    uint64_t ttbr1;
+} ttbr_state_t;
+
+static inline uint64_t irq_save()
+{
+    uint64_t flags;
+    asm volatile("mrs %0, daif" : "=r"(flags));
+    asm volatile("msr daifset, #2" ::: "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint64_t flags)
+{
+    asm volatile("msr daif, %0" ::"r"(flags) : "memory");
+}
+
+/*
+ * As uaccess_ttbr0_enable, the asid goes to ttbr1 first, then the user table to ttbr0.
+ * An exception taken meanwhile sees the non reserved asid in ttbr0 and restores it on return,
+ * so only the switch itself runs with irqs masked.
+ */
+static void ttbr0_enable(uint64_t user_ttbr0, ttbr_state_t *saved)
+{
+    uint64_t flags = irq_save();
+    asm volatile("mrs %0, ttbr0_el1" : "=r"(saved->ttbr0));
+    asm volatile("mrs %0, ttbr1_el1" : "=r"(saved->ttbr1));
+    uint64_t ttbr1 = (saved->ttbr1 & ~TTBR_ASID_MASK) | (user_ttbr0 & TTBR_ASID_MASK);
+    asm volatile("msr ttbr1_el1, %0" ::"r"(ttbr1) : "memory");
+    asm volatile("isb" ::: "memory");
+    asm volatile("msr ttbr0_el1, %0" ::"r"(user_ttbr0) : "memory");
+    asm volatile("isb" ::: "memory");
+    irq_restore(flags);
+}
+
+// As uaccess_ttbr0_disable, the reserved table and asid saved by ttbr0_enable are put back.
+static void ttbr0_disable(const ttbr_state_t *saved)
+{
+    uint64_t flags = irq_save();
+    asm volatile("msr ttbr0_el1, %0" ::"r"(saved->ttbr0) : "memory");
+    asm volatile("isb" ::: "memory");
+    asm volatile("msr ttbr1_el1, %0" ::"r"(saved->ttbr1) : "memory");
+    asm volatile("isb" ::: "memory");
+    irq_restore(flags);
+}
+
+static inline bool native_uaccess_ok(const void __user *addr, unsigned long n)
+{
+    uintptr_t start = (uintptr_t)addr;
+    uintptr_t end = start + n;
+    if (end < start) return false;
+    return end <= user_task_size();
+}
+
+typedef unsigned long (*raw_copy_f)(void *to, const void *from, unsigned long n);
+
+/**
+ * @brief Copy with the kernel raw arm64 copy routine, faults are fixed up by the kernel exception table.
+ * User access is opened the way the kernel does around the routine: PAN and UAO cleared,
+ * or the user page table switched in with sw ttbr0 pan.
+ * 
+ * @return int copied length, 0 if native copy is not usable, negative error
+ */
+static int native_copy_user(raw_copy_f copy, void *to, const void *from, const void __user *uaddr, int n)
+{
+    if (!copy || n <= 0) return 0;
+    if (!native_uaccess_ok(uaddr, n)) return -EFAULT;
+
+    uint64_t user_ttbr0 = 0;
+    if (ttbr0_is_reserved()) {
+        user_ttbr0 = current_user_ttbr0();
+        if (!user_ttbr0) return 0;
+    }
+
+    bool has_pan = cpu_has_pan();
+    bool has_uao = cpu_has_uao();
+    int off = 0;
+    while (off < n) {
+        int len = n - off > NATIVE_UACCESS_CHUNK ? NATIVE_UACCESS_CHUNK : n - off;
+        uint64_t pan = 0, uao = 0;
+        ttbr_state_t ttbr;
+        if (user_ttbr0) ttbr0_enable(user_ttbr0, &ttbr);
+        if (has_pan) pan = pan_save_clear();
+        if (has_uao) uao = uao_save_clear();
+        unsigned long left = copy(to + off, from + off, len);
+        if (has_uao) uao_restore(uao);
+        if (has_pan) pan_restore(pan);
+        if (user_ttbr0) ttbr0_disable(&ttbr);
+        off += len - left;
+        if (left) return off ?: -EFAULT;
+    }
+    return off;
+}
+
+static raw_copy_f native_copy_to_user_func()
+{
+    if (kfunc(__arch_copy_to_user)) return (raw_copy_f)kfunc(__arch_copy_to_user);
+    return (raw_copy_f)kfunc(__copy_to_user);
+}
+
+static raw_copy_f native_copy_from_user_func()
+{
+    if (kfunc(__arch_copy_from_user)) return (raw_copy_f)kfunc(__arch_copy_from_user);
+    return (raw_copy_f)kfunc(__copy_from_user);
+}
+
 int seq_buf_copy_to_user(void __user *to, const void *from, int n)
 {
     struct seq_buf seq_buf;
@@ -73,7 +284,8 @@ int seq_buf_copy_to_user(void __user *to, const void *from, int n)
  */
 int __must_check compat_copy_to_user(void __user *to, const void *from, int n)
 {
-    int cplen = 0;
+    int cplen = native_copy_user(native_copy_to_user_func(), to, from, to, n);
+    if (cplen) return cplen;
 
     if (kfunc(seq_buf_to_user)) {
         cplen = seq_buf_copy_to_user(to, from, n);
@@ -85,7 +297,7 @@ int __must_check compat_copy_to_user(void __user *to, const void *from, int n)
         // bits_to_user, str_to_user
         cplen = compat_bits_copy_to_user(to, from, n);
     } else if (kfunc(trace_seq_to_user)) {
-        cplen = trace_seq_copy_to_user(to, from, n);
+        cplen = trace_seq_copy_to_user_chunked(to, from, n);
     } else {
         logke("no compat_copy_to_user\n");
         // copy_arg_to_user,
@@ -94,7 +306,33 @@ int __must_check compat_copy_to_user(void __user *to, const void *from, int n)
 }
 KP_EXPORT_SYMBOL(compat_copy_to_user);
 
-#include <linux/uaccess.h>
+/**
+ * @brief Copy from user into caller storage, no allocation when the pages are resident
+ * 
+ * @param to 
+ * @param from 
+ * @param n 
+ * @return int copied length
+ */
+int __must_check compat_copy_from_user(void *to, const void __user *from, int n)
+{
+    if (n <= 0) return 0;
+    int cplen = native_copy_user(native_copy_from_user_func(), to, from, from, n);
+    if (cplen) return cplen;
+
+    if (kfunc(copy_from_user_nofault)) {
+        if (!kfunc(copy_from_user_nofault)(to, from, n)) return n;
+    } else if (kfunc(probe_user_read)) {
+        if (!kfunc(probe_user_read)(to, from, n)) return n;
+    }
+    // not resident or no nofault helper
+    void *data = memdup_user(from, n);
+    if (IS_ERR(data)) return PTR_ERR(data);
+    memcpy(to, data, n);
+    kfree(data);
+    return n;
+}
+KP_EXPORT_SYMBOL(compat_copy_from_user);
 
 long compat_strncpy_from_user(char *dest, const char __user *src, long count)
 {
@@ -116,6 +354,16 @@ KP_EXPORT_SYMBOL(compat_strncpy_from_user);
 
 int16_t pt_regs_offset = -1;
 
+int pt_regs_size_of_kver()
+{
+#ifndef ANDROID
+    if (kver < VERSION(4, 4, 19)) return sizeof(struct pt_regs_lt4419); // 0x120
+    if (kver < VERSION(4, 14, 0)) return sizeof(struct pt_regs_lt4140); // 0x130
+#endif
+    if (kver < VERSION(5, 10, 0)) return sizeof(struct pt_regs_lt5100); // 0x140
+    return sizeof(struct pt_regs); // 0x150
+}
+
 struct pt_regs *_task_pt_reg(struct task_struct *task)
 {
     unsigned long stack = (unsigned long)task_stack_page(task);
@@ -123,18 +371,7 @@ struct pt_regs *_task_pt_reg(struct task_struct *task)
     if (pt_regs_offset > 0) {
         addr -= pt_regs_offset;
     } else {
-#ifndef ANDROID
-        if (kver < VERSION(4, 4, 19)) {
-            addr -= sizeof(struct pt_regs_lt4419); // 0x120
-        } else if (kver < VERSION(4, 14, 0)) {
-            addr -= sizeof(struct pt_regs_lt4140); // 0x130
-        } else
-#endif
-            if (kver < VERSION(5, 10, 0)) {
-            addr -= sizeof(struct pt_regs_lt5100); // 0x140
-        } else {
-            addr -= sizeof(struct pt_regs); // 0x150
-        }
+        addr -= pt_regs_size_of_kver();
     }
 
     return (struct pt_regs *)(addr);
@@ -159,6 +396,27 @@ uint64_t get_random_u64(void)
 }
 KP_EXPORT_SYMBOL(get_random_u64);
 
+/**
+ * @brief [start, end) of the kernel function name, for hook_wrap_callers
+ * 
+ * @param name 
+ * @param start 
+ * @param end 
+ * @return int 0, -ENOENT or -ENOSYS without kallsyms_lookup_size_offset
+ */
+int caller_range_of_symbol(const char *name, uint64_t *start, uint64_t *end)
+{
+    unsigned long addr = kallsyms_lookup_name(name);
+    if (!addr) return -ENOENT;
+    if (!kfunc(kallsyms_lookup_size_offset)) return -ENOSYS;
+    unsigned long size = 0, offset = 0;
+    if (!kfunc(kallsyms_lookup_size_offset)(addr, &size, &offset) || !size) return -ENOENT;
+    *start = addr - offset;
+    *end = *start + size;
+    return 0;
+}
+KP_EXPORT_SYMBOL(caller_range_of_symbol);
+
 // todo: rcu_dereference_protected
 uid_t current_uid()
 {
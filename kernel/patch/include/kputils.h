@@ -10,10 +10,12 @@
 #include <ktypes.h>
 
 int __must_check compat_copy_to_user(void __user *to, const void *from, int n);
+int __must_check compat_copy_from_user(void *to, const void __user *from, int n);
 long compat_strncpy_from_user(char *dest, const char __user *src, long count);
 void *__user copy_to_user_stack(const void *data, int len);
 uid_t current_uid();
 uint64_t get_random_u64(void);
+int caller_range_of_symbol(const char *name, uint64_t *start, uint64_t *end);
 
 void print_bootlog();
 
@@ -48,6 +48,10 @@ struct module
 
     void *start;
 
+    Elf_Sym *symtab;
+    unsigned int num_symtab;
+    const char *strtab;
+
     struct list_head list;
     atomic_t refcnt;
 };
@@ -62,5 +66,10 @@ struct module *find_module(const char *name);
 int get_module_nums();
 int list_modules(char *out_names, int size);
 int get_module_info(const char *name, char *out_info, int size);
+int module_name_of(void *owner, char *buf, int len);
+int module_addr_symbol(unsigned long addr, char *sym, int sym_len);
+
+struct hook_info;
+long list_hooks(struct hook_info *__user out, int start, int num);
 
 #endif
\ No newline at end of file
@@ -28,9 +28,12 @@ int su_add_allow_uid(uid_t uid, uid_t to_uid, const char *scontext);
 int su_remove_allow_uid(uid_t uid);
 int su_allow_uid_nums();
 int su_allow_uids(int is_user, uid_t *out_uids, int out_num);
+int su_allow_list(int is_user, void *out, int out_num, int flags);
+int su_allow_list_from(int start, void *out, int out_num, int flags);
 int su_allow_uid_profile(int is_user, uid_t uid, struct su_profile *profile);
 int su_reset_path(const char *path);
 const char *su_get_path();
+int su_get_path_copy(char *buf, int buf_len);
 
 int get_ap_mod_exclude(uid_t uid);
 int set_ap_mod_exclude(uid_t uid, int exclude);
@@ -39,6 +39,32 @@ long raw_syscall6(long nr, long arg0, long arg1, long arg2, long arg3, long arg4
 
 #define raw_syscall(f) raw_syscall##f
 
+/**
+ * @brief Prepared syscall, for callers that issue the same syscall repeatedly.
+ * The handler is resolved once and regs is reused, only changed arguments need to be set between calls.
+ */
+struct raw_syscall_ctx
+{
+    uintptr_t addr;
+    struct pt_regs regs;
+};
+
+/**
+ * @brief 
+ * 
+ * @param ctx 
+ * @param nr 
+ * @return int 0 on success, -ENOSYS if there is no handler
+ */
+int raw_syscall_ctx_init(struct raw_syscall_ctx *ctx, long nr);
+
+static inline void raw_syscall_ctx_set_arg(struct raw_syscall_ctx *ctx, int n, long val)
+{
+    ctx->regs.regs[n] = val;
+}
+
+long raw_syscall_ctx_call(struct raw_syscall_ctx *ctx);
+
 uintptr_t syscalln_name_addr(int nr, int is_compat);
 
 uintptr_t syscalln_addr(int nr, int is_compat);
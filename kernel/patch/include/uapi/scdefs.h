@@ -60,6 +60,29 @@ struct kernel_storage
 #define KSTORAGE_UNUSED_GROUP_2 2
 #define KSTORAGE_UNUSED_GROUP_3 3
 
+#define SUPERCALL_HOOK_LIST 0x1050
+
+#define HOOK_INFO_NAME_LEN 32
+#define HOOK_INFO_SYM_LEN 64
+
+// SUPERCALL_HOOK_LIST record, one per chain item.
+// A plain inline hook has item -1 and the symbol of its replace in before_sym.
+struct hook_info
+{
+    unsigned long origin;
+    unsigned long replace;
+    unsigned long before;
+    unsigned long after;
+    unsigned long calls;
+    int type;
+    unsigned int flags;
+    int item;
+    int priority;
+    char owner[HOOK_INFO_NAME_LEN];
+    char before_sym[HOOK_INFO_SYM_LEN];
+    char after_sym[HOOK_INFO_SYM_LEN];
+};
+
 #define SUPERCALL_BOOTLOG 0x10fd
 #define SUPERCALL_PANIC 0x10fe
 #define SUPERCALL_TEST 0x10ff
@@ -94,6 +117,9 @@ struct su_profile
 
 #define SU_PATH_MAX_LEN 128
 
+// SUPERCALL_SU_LIST_EX flags, fill struct su_profile records instead of uid_t
+#define SU_LIST_FLAG_PROFILE 0x1
+
 #define SUPERCMD "/system/bin/truncate"
 
 #define SAFE_MODE_FLAG_FILE "/dev/.safemode"
@@ -105,6 +131,7 @@ struct su_profile
 #define SUPERCALL_SU_PROFILE 0x1104
 #define SUPERCALL_SU_GET_ALLOW_SCTX 0x1105
 #define SUPERCALL_SU_SET_ALLOW_SCTX 0x1106
+#define SUPERCALL_SU_LIST_EX 0x1107
 #define SUPERCALL_SU_GET_PATH 0x1110
 #define SUPERCALL_SU_RESET_PATH 0x1111
 #define SUPERCALL_SU_GET_SAFEMODE 0x1112
@@ -6,6 +6,48 @@
 #ifndef _KP_USER_EVENT_H_
 #define _KP_USER_EVENT_H_
 
+#include <ktypes.h>
+
+#define USER_EVENT_HANDLER_MAX 16
+
+// return USER_EVENT_RUN_USER if userspace work is needed for this event
+#define USER_EVENT_RUN_USER 1
+
+/**
+ * @brief Handler of events reported by userspace or boot stages
+ * 
+ * @param event e.g. early-init, init, late-init, post-fs-data, services, boot-completed
+ * @param args may be NULL
+ * @param udata
+ * @return int 0, USER_EVENT_RUN_USER or negative error
+ */
+typedef int (*user_event_handler_t)(const char *event, const char *args, void *udata);
+
+int add_user_event_handler(user_event_handler_t handler, void *udata);
+
+/**
+ * @brief Remove the handler and wait for the reports running it, sleeps, never call it from the handler itself
+ * 
+ * @param handler 
+ * @param udata 
+ */
+void remove_user_event_handler(user_event_handler_t handler, void *udata);
+
+/**
+ * @brief Remove every handler whose code is in [start, end), e.g. of a module being unloaded, and wait for them
+ * 
+ * @param start 
+ * @param end 
+ */
+void remove_user_event_handlers_in(uintptr_t start, uintptr_t end);
+
+/**
+ * @brief Dispatch event to all handlers
+ * 
+ * @param event 
+ * @param args 
+ * @return int USER_EVENT_RUN_USER if any handler asked for userspace work, otherwise 0
+ */
 int report_user_event(const char *event, const char *args);
 
-#endif
\ No newline at end of file
+#endif
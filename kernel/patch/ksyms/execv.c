@@ -7,6 +7,74 @@
 #include <linux/ptrace.h>
 #include <log.h>
 #include <preset.h>
+#include <kallsyms.h>
+
+#define PT_REGS_SIZE_MIN 0x110
+#define PT_REGS_SIZE_MAX 0x200
+#define COPY_THREAD_INSN_NUM 128
+
+// add/sub xd, xn, #imm{, lsl #12}
+#define INST_ADD_IMM_64 0x91000000
+#define INST_SUB_IMM_64 0xd1000000
+#define MASK_ADDSUB_IMM_64 0xff000000
+
+static inline bool is_addsub_imm64(uint32_t inst)
+{
+    uint32_t op = inst & MASK_ADDSUB_IMM_64;
+    return op == INST_ADD_IMM_64 || op == INST_SUB_IMM_64;
+}
+
+static inline int64_t addsub_imm64_val(uint32_t inst)
+{
+    int64_t imm = (inst >> 10) & 0xfff;
+    if ((inst >> 22) & 1) imm <<= 12;
+    return (inst & MASK_ADDSUB_IMM_64) == INST_SUB_IMM_64 ? -imm : imm;
+}
+
+static inline int pt_regs_size_from_stack_off(int64_t off)
+{
+    int64_t size = thread_size - off;
+    if (off <= 0 || size < PT_REGS_SIZE_MIN || size > PT_REGS_SIZE_MAX || (size & 0xf)) return -1;
+    return size;
+}
+
+/**
+ * @brief copy_thread() does childregs = task_pt_regs(p), which is
+ * task_stack_page(p) + THREAD_SIZE - sizeof(struct pt_regs), usually emitted as
+ * add xd, xn, #hi, lsl #12 followed by add/sub xd, xd, #lo.
+ * Any other add pair in range could match, so only the sizeof(struct pt_regs) of the kernel version is taken,
+ * anything else is left to the scan at the first exec.
+ * 
+ * @return int offset of pt_regs from the top of stack, -1 if not found
+ */
+static int derive_pt_regs_offset()
+{
+    if (thread_size <= 0) return -1;
+    int expected = pt_regs_size_of_kver();
+    uint32_t *insts = (uint32_t *)kallsyms_lookup_name("copy_thread");
+    if (!insts) insts = (uint32_t *)kallsyms_lookup_name("copy_thread_tls");
+    if (!insts) return -1;
+
+    for (int i = 0; i < COPY_THREAD_INSN_NUM - 1; i++) {
+        uint32_t hi = insts[i];
+        uint32_t lo = insts[i + 1];
+        if (!is_addsub_imm64(hi) || !is_addsub_imm64(lo)) continue;
+        if (!((hi >> 22) & 1) || ((lo >> 22) & 1)) continue;
+        uint32_t hi_rd = hi & 0x1f;
+        uint32_t lo_rn = (lo >> 5) & 0x1f;
+        uint32_t lo_rd = lo & 0x1f;
+        if (lo_rn != hi_rd || lo_rd != hi_rd) continue;
+        int size = pt_regs_size_from_stack_off(addsub_imm64_val(hi) + addsub_imm64_val(lo));
+        if (size <= 0) continue;
+        if (size != expected) {
+            log_boot("    pt_regs candidate at copy_thread+%x: %x, expected: %x\n", i * 4, size, expected);
+            continue;
+        }
+        log_boot("    pt_regs from copy_thread+%x\n", i * 4);
+        return size;
+    }
+    return -1;
+}
 
 static int first_init_execed = 0;
 
@@ -37,6 +105,7 @@ static void before_execve(hook_fargs3_t *args, void *udata)
 
     unsigned long stack = (unsigned long)get_stack(current);
     uintptr_t addr = (uintptr_t)(thread_size + stack);
+    int16_t scanned = -1;
 
     for (uintptr_t i = addr - sizeof(struct pt_regs) - 0x40; i < addr - 32 * 8; i += sizeof(uint32_t)) {
         uintptr_t val0 = *(uintptr_t *)i;
@@ -46,11 +115,17 @@ static void before_execve(hook_fargs3_t *args, void *udata)
         if ((arg0 == val0) && (val1 == arg1) && (val2 == arg2)) {
             struct pt_regs *regs = (struct pt_regs *)i;
             if (regs->orig_x0 == arg0 && regs->syscallno == nr && regs->regs[8] == nr) {
-                pt_regs_offset = addr - i;
+                scanned = addr - i;
                 break;
             }
         }
     }
+
+    // verify the offset derived at init
+    if (scanned > 0 && scanned != pt_regs_offset) {
+        log_boot("    pt_regs offset mismatch, derived: %x, scanned: %x\n", pt_regs_offset, scanned);
+        pt_regs_offset = scanned;
+    }
     log_boot("    pt_regs offset: %x\n", pt_regs_offset);
 }
 
@@ -65,6 +140,10 @@ int resolve_pt_regs()
     hook_err_t ret = 0;
     hook_err_t rc = HOOK_NO_ERR;
 
+    int offset = derive_pt_regs_offset();
+    if (offset > 0) pt_regs_offset = offset;
+    log_boot("derived pt_regs offset: %x\n", offset);
+
     rc = hook_syscalln(__NR_execve, 3, before_execve, after_execv, (void *)__NR_execve);
     log_boot("hook __NR_execve rc: %d\n", rc);
     ret |= rc;
@@ -25,6 +25,16 @@ long kfunc_def(strncpy_from_user_nofault)(char *dst, const void __user *unsafe_a
 long kfunc_def(strncpy_from_unsafe_user)(char *dst, const void __user *unsafe_addr, long count) = 0;
 long kfunc_def(strncpy_from_user)(char *dest, const char __user *src, long count) = 0;
 
+unsigned long kfunc_def(__arch_copy_to_user)(void __user *to, const void *from, unsigned long n) = 0;
+unsigned long kfunc_def(__arch_copy_from_user)(void *to, const void __user *from, unsigned long n) = 0;
+unsigned long kfunc_def(__copy_to_user)(void __user *to, const void *from, unsigned long n) = 0;
+unsigned long kfunc_def(__copy_from_user)(void *to, const void __user *from, unsigned long n) = 0;
+char kvar_def(reserved_ttbr0) = 0;
+char kvar_def(reserved_pg_dir) = 0;
+
+long kfunc_def(copy_from_user_nofault)(void *dst, const void __user *src, size_t size) = 0;
+long kfunc_def(probe_user_read)(void *dst, const void __user *src, size_t size) = 0;
+
 long kfunc_def(strnlen_user_nofault)(const void __user *unsafe_addr, long count) = 0;
 long kfunc_def(strnlen_unsafe_user)(const void __user *unsafe_addr, long count) = 0;
 long kfunc_def(strnlen_user)(const char __user *str, long n);
@@ -35,6 +45,16 @@ static void _linux_lib_strncpy_from_user_sym_match(const char *name, unsigned lo
     kfunc_match(strncpy_from_unsafe_user, name, addr);
     kfunc_match(strncpy_from_user, name, addr);
 
+    kfunc_match(__arch_copy_to_user, name, addr);
+    kfunc_match(__arch_copy_from_user, name, addr);
+    kfunc_match(__copy_to_user, name, addr);
+    kfunc_match(__copy_from_user, name, addr);
+    kvar_match(reserved_ttbr0, name, addr);
+    kvar_match(reserved_pg_dir, name, addr);
+
+    kfunc_match(copy_from_user_nofault, name, addr);
+    kfunc_match(probe_user_read, name, addr);
+
     // kfunc_match(strnlen_user_nofault, name, addr);
     // kfunc_match(strnlen_unsafe_user, name, addr);
     // kfunc_match(strnlen_user, name, addr);
@@ -259,15 +259,45 @@ void _linux_kernel_pid_sym_match(const char *name, unsigned long addr)
 
 bool kvar_def(stop_machine_initialized) = 0;
 const struct cpumask *kvar_def(cpu_online_mask) = 0;
+char kvar_def(__cpu_online_mask) = 0;
 int kfunc_def(stop_machine)(int (*fn)(void *), void *data, const struct cpumask *cpus) = 0;
 
 static void _linux_kernel_stop_machine_sym_match(const char *name, unsigned long addr)
 {
     // kvar_match(stop_machine_initialized, name, addr);
-    // kvar_match(cpu_online_mask, name, addr);
+    kvar_match(cpu_online_mask, name, addr);
+    kvar_match(__cpu_online_mask, name, addr);
     kfunc_match(stop_machine, name, addr);
 }
 
+// kernel/smp.c
+#include <linux/smp.h>
+
+void kfunc_def(on_each_cpu)(smp_call_func_t func, void *info, int wait) = 0;
+void kfunc_def(on_each_cpu_cond_mask)(smp_cond_func_t cond_func, smp_call_func_t func, void *info, bool wait,
+                                      const struct cpumask *mask) = 0;
+
+static void _linux_kernel_smp_sym_match(const char *name, unsigned long addr)
+{
+    kfunc_match(on_each_cpu, name, addr);
+    kfunc_match(on_each_cpu_cond_mask, name, addr);
+}
+
+// kernel/kthread.c
+#include <linux/kthread.h>
+
+struct task_struct *kfunc_def(kthread_create_on_node)(int (*threadfn)(void *data), void *data, int node,
+                                                       const char namefmt[], ...) = 0;
+void kfunc_def(kthread_bind)(struct task_struct *k, unsigned int cpu) = 0;
+int kfunc_def(wake_up_process)(struct task_struct *p) = 0;
+
+static void _linux_kernel_kthread_sym_match(const char *name, unsigned long addr)
+{
+    kfunc_match(kthread_create_on_node, name, addr);
+    kfunc_match(kthread_bind, name, addr);
+    kfunc_match(wake_up_process, name, addr);
+}
+
 // mm/util.c
 struct file;
 struct page;
@@ -442,6 +472,12 @@ void kfunc_def(final_putname)(struct filename *name) = 0;
 
 loff_t kfunc_def(vfs_llseek)(struct file *file, loff_t offset, int whence) = 0;
 
+long kfunc_def(do_splice_direct)(struct file *in, loff_t *ppos, struct file *out, loff_t *opos, size_t len,
+                                unsigned int flags) = 0;
+
+struct file *kfunc_def(fget)(unsigned int fd) = 0;
+void kfunc_def(fput)(struct file *) = 0;
+
 static void _linux_fs_sym_match(const char *name, unsigned long addr)
 {
     // kfunc_match(inc_nlink, name, addr);
@@ -461,6 +497,9 @@ static void _linux_fs_sym_match(const char *name, unsigned long addr)
     // kfunc_match(putname, name, addr);
     // kfunc_match(final_putname, name, addr);
     kfunc_match(vfs_llseek, name, addr);
+    kfunc_match(do_splice_direct, name, addr);
+    kfunc_match(fget, name, addr);
+    kfunc_match(fput, name, addr);
 }
 
 #include <linux/stacktrace.h>
@@ -480,6 +519,13 @@ static void _linux_stacktrace_sym_match(const char *name, unsigned long addr)
     // kfunc_match(save_stack_trace_user, name, addr);
 }
 
+int kfunc_def(kallsyms_lookup_size_offset)(unsigned long addr, unsigned long *symbolsize, unsigned long *offset) = 0;
+
+static void _linux_kallsyms_sym_match(const char *name, unsigned long addr)
+{
+    kfunc_match(kallsyms_lookup_size_offset, name, addr);
+}
+
 #include <security/selinux/include/avc.h>
 
 int kfunc_def(avc_denied)(u32 ssid, u32 tsid, u16 tclass, u32 requested, u8 driver, u8 xperm, unsigned int flags,
@@ -721,6 +767,7 @@ static void _linux_seccomp_sym_match(const char *name, unsigned long addr)
 
 #include <linux/panic.h>
 #include <linux/umh.h>
+#include <linux/delay.h>
 
 void kfunc_def(panic)(const char *fmt, ...) __noreturn __cold = 0;
 int kfunc_def(call_usermodehelper)(const char *path, char **argv, char **envp, int wait) = 0;
@@ -730,6 +777,9 @@ void kfunc_def(get_random_bytes)(void *buf, int nbytes) = 0;
 uint64_t kfunc_def(get_random_u64)(void) = 0;
 uint64_t kfunc_def(get_random_long)(void) = 0;
 
+// kernel/time/timer.c
+void kfunc_def(msleep)(unsigned int msecs) = 0;
+
 static void _linux_misc_misc(const char *name, unsigned long addr)
 {
     kfunc_match(panic, name, addr);
@@ -737,6 +787,7 @@ static void _linux_misc_misc(const char *name, unsigned long addr)
     // kfunc_match(get_random_bytes, name, addr);
     // kfunc_match(get_random_u64, name, addr);
     // kfunc_match(get_random_long, name, addr);
+    kfunc_match(msleep, name, addr);
 }
 
 // linux/bottom_half.h
@@ -750,6 +801,7 @@ void kfunc_def(call_rcu)(struct rcu_head *head, rcu_callback_t func);
 void kfunc_def(rcu_barrier_tasks)(void);
 void kfunc_def(rcu_barrier_tasks_rude)(void);
 void kfunc_def(synchronize_rcu)(void);
+void kfunc_def(synchronize_rcu_tasks)(void);
 unsigned long kfunc_def(get_completed_synchronize_rcu)(void);
 void kfunc_def(get_completed_synchronize_rcu_full)(struct rcu_gp_oldstate *rgosp);
 
@@ -794,6 +846,7 @@ static void _linux_rcu_symbol_init(const char *name, unsigned long addr)
     // kfunc_match(rcu_barrier_tasks, name, addr);
     // kfunc_match(rcu_barrier_tasks_rude, name, addr);
     kfunc_match(synchronize_rcu, name, addr);
+    kfunc_match(synchronize_rcu_tasks, name, addr);
     // kfunc_match(get_completed_synchronize_rcu, name, addr);
     // kfunc_match(get_completed_synchronize_rcu_full, name, addr);
 
@@ -843,11 +896,14 @@ static int _linux_misc_symbol_init(void *data, const char *name, struct module *
     _linux_kernel_cred_sym_match(name, addr);
     _linux_kernel_pid_sym_match(name, addr);
     _linux_kernel_stop_machine_sym_match(name, addr);
+    _linux_kernel_smp_sym_match(name, addr);
+    _linux_kernel_kthread_sym_match(name, addr);
     _linux_mm_utils_sym_match(name, addr);
     _linux_mm_vmalloc_sym_match(name, addr);
     _linux_fs_sym_match(name, addr);
     _linux_locking_spinlock_sym_match(name, addr);
     _linux_stacktrace_sym_match(name, addr);
+    _linux_kallsyms_sym_match(name, addr);
     _linux_security_selinux_sym_match(name, addr);
     _linux_security_commoncap_sym_match(name, addr);
     _linux_misc_misc(name, addr);
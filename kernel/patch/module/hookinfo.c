@@ -0,0 +1,134 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/* 
+ * Copyright (C) 2023 bmax121. All Rights Reserved.
+ */
+
+#include <hook.h>
+#include <log.h>
+#include <kputils.h>
+#include <uapi/scdefs.h>
+#include <linux/string.h>
+#include <linux/kernel.h>
+#include <uapi/asm-generic/errno.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <vdso/limits.h>
+#include <module.h>
+
+// At most this many records per call, callers page with start.
+#define HOOK_LIST_MAX 256
+
+// The part of a struct hook_info taken under the hook lock.
+struct hook_record
+{
+    unsigned long origin;
+    unsigned long replace;
+    unsigned long before;
+    unsigned long after;
+    unsigned long calls;
+    void *owner;
+    int type;
+    unsigned int flags;
+    int item;
+    int priority;
+};
+
+struct hook_list_ctx
+{
+    struct hook_record *records;
+    int start;
+    int end;
+    int index;
+};
+
+// Called with the hook lock held, no symbol lookup, user copy or anything that sleeps here.
+static int put_hook_record(struct hook_list_ctx *ctx, const hook_entry_t *entry, int item)
+{
+    int index = ctx->index++;
+    if (!ctx->records || index < ctx->start) return 0;
+    if (index >= ctx->end) return 1;
+
+    struct hook_record *rec = &ctx->records[index - ctx->start];
+    memset(rec, 0, sizeof(*rec));
+    rec->origin = entry->origin;
+    rec->replace = entry->replace;
+    rec->calls = entry->calls;
+    rec->type = entry->type;
+    rec->flags = entry->flags;
+    rec->item = item;
+    if (item >= 0) {
+        const hook_chain_item_t *chain_item = &entry->items->items[item];
+        rec->before = (unsigned long)chain_item->before;
+        rec->after = (unsigned long)chain_item->after;
+        rec->priority = chain_item->priority;
+        rec->owner = chain_item->owner;
+    }
+    return 0;
+}
+
+static int list_hook_entry(const hook_entry_t *entry, void *udata)
+{
+    struct hook_list_ctx *ctx = (struct hook_list_ctx *)udata;
+    if (!entry->items) return put_hook_record(ctx, entry, -1);
+    hook_chain_items_t *items = entry->items;
+    for (int i = 0; i < items->num; i++) {
+        if (put_hook_record(ctx, entry, i)) return 1;
+    }
+    return 0;
+}
+
+static long put_hook_info(struct hook_info *__user out, const struct hook_record *rec)
+{
+    struct hook_info info;
+    memset(&info, 0, sizeof(info));
+    info.origin = rec->origin;
+    info.replace = rec->replace;
+    info.before = rec->before;
+    info.after = rec->after;
+    info.calls = rec->calls;
+    info.type = rec->type;
+    info.flags = rec->flags;
+    info.item = rec->item;
+    info.priority = rec->priority;
+    // the owner is only compared against loaded modules, never dereferenced
+    if (rec->owner) module_name_of(rec->owner, info.owner, sizeof(info.owner));
+    if (info.before) module_addr_symbol(info.before, info.before_sym, sizeof(info.before_sym));
+    if (info.after) module_addr_symbol(info.after, info.after_sym, sizeof(info.after_sym));
+    if (!info.before && !info.after) module_addr_symbol(info.replace, info.before_sym, sizeof(info.before_sym));
+
+    int cplen = compat_copy_to_user(out, &info, sizeof(info));
+    if (cplen != sizeof(info)) return cplen < 0 ? cplen : -EFAULT;
+    return 0;
+}
+
+/**
+ * @brief Fill out with the records [start, start + num) of all hooks, one record per chain item.
+ * At most HOOK_LIST_MAX records are filled per call.
+ * 
+ * @param out null to count
+ * @param start 
+ * @param num 
+ * @return long number of records filled, or the total number if out is null
+ */
+long list_hooks(struct hook_info *__user out, int start, int num)
+{
+    if (out && (start < 0 || num <= 0)) return -EINVAL;
+    if (num > HOOK_LIST_MAX) num = HOOK_LIST_MAX;
+    struct hook_list_ctx ctx = { .start = start, .end = num > INT_MAX - start ? INT_MAX : start + num };
+    if (out) {
+        ctx.records = (struct hook_record *)vmalloc(num * sizeof(struct hook_record));
+        if (!ctx.records) return -ENOMEM;
+    }
+
+    // snapshot under the hook lock, items can be freed as soon as it is dropped
+    hook_for_each(list_hook_entry, &ctx);
+    if (!out) return ctx.index;
+
+    long rc = 0;
+    int filled = ctx.index <= start ? 0 : (ctx.index < ctx.end ? ctx.index : ctx.end) - start;
+    for (int i = 0; i < filled; i++) {
+        if ((rc = put_hook_info(out + i, &ctx.records[i]))) break;
+    }
+    kvfree(ctx.records);
+    return rc ? rc : filled;
+}
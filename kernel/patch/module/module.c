@@ -15,6 +15,7 @@
 #include <linux/fs.h>
 #include <uapi/linux/fs.h>
 #include <hotpatch.h>
+#include <hook.h>
 #include <linux/list.h>
 #include <linux/kernel.h>
 #include <linux/spinlock.h>
@@ -23,6 +24,12 @@
 #include <linux/rcupdate.h>
 #include <linux/rculist.h>
 #include <asm/atomic.h>
+#include <asm/current.h>
+#include <linux/stop_machine.h>
+#include <linux/smp.h>
+#include <linux/kthread.h>
+#include <linux/delay.h>
+#include <user_event.h>
 #include "module.h"
 #include "relo.h"
 
@@ -160,6 +167,14 @@ static bool is_core_symbol(const Elf_Sym *src, const Elf_Shdr *sechdrs, unsigned
     return true;
 }
 
+// kernel symbols overflow CALL26/JUMP26 unless kpm text is within branch range of kernel text
+static unsigned long lookup_import(const char *name)
+{
+    unsigned long addr = symbol_lookup_name(name);
+    if (!addr && is_kp_exec_near_text()) addr = kallsyms_lookup_name(name);
+    return addr;
+}
+
 /* Change all symbols so that st_value encodes the pointer directly. */
 static int simplify_symbols(struct module *mod, const struct load_info *info)
 {
@@ -181,15 +196,11 @@ static int simplify_symbols(struct module *mod, const struct load_info *info)
         case SHN_ABS:
             break;
         case SHN_UNDEF:
-            unsigned long addr = symbol_lookup_name(name);
-            // kernel symbol cause overflow in relocation
-            // if (!addr) addr = kallsyms_lookup_name(name);
-            if (!addr) {
+            // resolved by check_undef_symbols
+            if (!sym[i].st_value) {
                 logke("unknown symbol: %s\n", name);
                 ret = -ENOENT;
-                break;
             }
-            sym[i].st_value = addr;
             break;
         default:
             secbase = info->sechdrs[sym[i].st_shndx].sh_addr;
@@ -200,9 +211,179 @@ static int simplify_symbols(struct module *mod, const struct load_info *info)
     return ret;
 }
 
+/**
+ * @brief Resolve all undefined symbols before anything is allocated, the address is stored in st_value,
+ * every missing one is reported.
+ * 
+ * @return int 0, or -ENOENT if any symbol is missing
+ */
+static int check_undef_symbols(const struct load_info *info)
+{
+    Elf_Shdr *symsec = &info->sechdrs[info->index.sym];
+    Elf_Sym *sym = (void *)info->hdr + symsec->sh_offset;
+    int missing = 0;
+
+    for (int i = 1; i < symsec->sh_size / sizeof(Elf_Sym); i++) {
+        if (sym[i].st_shndx != SHN_UNDEF || !sym[i].st_name) continue;
+        const char *name = info->strtab + sym[i].st_name;
+        unsigned long addr = lookup_import(name);
+        sym[i].st_value = addr;
+        if (addr) continue;
+        logke("unknown symbol: %s\n", name);
+        missing++;
+    }
+    if (missing) {
+        logke("%s: %d unknown symbols\n", info->info.name, missing);
+        return -ENOENT;
+    }
+    return 0;
+}
+
+// below this, starting a thread on every cpu costs more than it saves
+#define RELA_PARALLEL_MIN_NUM 16384
+#define RELA_CHUNK_NUM 2048
+// only the first word of the online mask is walked, later cpus get no thread
+#define RELA_MAX_CPUS (8 * sizeof(unsigned long))
+
+struct relo_work
+{
+    struct module *mod;
+    const struct load_info *info;
+    int chunks;
+    atomic_t next;
+    atomic_t rc;
+    atomic_t running;
+};
+
+static unsigned int rela_num(const struct load_info *info, unsigned int i)
+{
+    unsigned int infosec = info->sechdrs[i].sh_info;
+    if (info->sechdrs[i].sh_type != SHT_RELA) return 0;
+    if (infosec >= info->hdr->e_shnum) return 0;
+    if (!(info->sechdrs[infosec].sh_flags & SHF_ALLOC)) return 0;
+    return info->sechdrs[i].sh_size / sizeof(Elf64_Rela);
+}
+
+static int relocate_chunk(struct relo_work *work, int chunk)
+{
+    const struct load_info *info = work->info;
+    for (unsigned int i = 1; i < info->hdr->e_shnum; i++) {
+        unsigned int num = rela_num(info, i);
+        int sec_chunks = (num + RELA_CHUNK_NUM - 1) / RELA_CHUNK_NUM;
+        if (chunk >= sec_chunks) {
+            chunk -= sec_chunks;
+            continue;
+        }
+        unsigned int start = chunk * RELA_CHUNK_NUM;
+        unsigned int end = start + RELA_CHUNK_NUM < num ? start + RELA_CHUNK_NUM : num;
+        return apply_relocate_add_range(info->sechdrs, info->strtab, info->index.sym, i, start, end, work->mod);
+    }
+    return 0;
+}
+
+// chunks are taken from a shared counter, whoever runs first takes the most
+static void relocate_chunks(struct relo_work *work)
+{
+    int chunk;
+    while ((chunk = atomic_inc_return(&work->next) - 1) < work->chunks && !atomic_read(&work->rc)) {
+        int rc = relocate_chunk(work, chunk);
+        if (rc < 0) atomic_cmpxchg(&work->rc, 0, rc);
+    }
+}
+
+// per-cpu kthread, work lives on the loader's stack and is not touched after running drops
+static int relocate_thread(void *data)
+{
+    struct relo_work *work = (struct relo_work *)data;
+    relocate_chunks(work);
+    atomic_dec(&work->running);
+    return 0;
+}
+
+static const struct cpumask *online_cpus()
+{
+    if (kvar(__cpu_online_mask)) return (const struct cpumask *)kvar(__cpu_online_mask);
+    if (kvar(cpu_online_mask)) return kvar_val(cpu_online_mask);
+    return 0;
+}
+
+// Only cpus taking the ipi work, unlike stop_machine nothing else is parked.
+static int run_on_each_cpu(smp_call_func_t func, void *info)
+{
+    if (kfunc(on_each_cpu)) {
+        kfunc(on_each_cpu)(func, info, 1);
+        return 0;
+    }
+    const struct cpumask *cpus = online_cpus();
+    if (kfunc(on_each_cpu_cond_mask) && cpus && kver >= VERSION(5, 7, 0)) {
+        kfunc(on_each_cpu_cond_mask)(0, func, info, true, cpus);
+        return 0;
+    }
+    return 1;
+}
+
+static void flush_icache_local(void *info)
+{
+    flush_icache_all();
+}
+
+// ic ialluis is broadcast already, the ipi also puts every cpu through an isb
+static void flush_module_icache()
+{
+    if (run_on_each_cpu(flush_icache_local, 0)) flush_icache_all();
+}
+
+/*
+ * Relocation runs in a kthread bound to each online cpu, plus the loader itself,
+ * all in process context with interrupts on. The loader sleeps until every thread
+ * it started has dropped running. Before smp is up (pre-kernel-init kpm) only one
+ * cpu is online and the serial loop is used.
+ */
+static int apply_relocations_parallel(struct module *mod, const struct load_info *info)
+{
+    if (!kfunc(kthread_create_on_node) || !kfunc(kthread_bind) || !kfunc(wake_up_process) || !kfunc(msleep)) return 1;
+    const unsigned long *online = (const unsigned long *)online_cpus();
+    if (!online || __builtin_popcountl(online[0]) < 2) return 1;
+
+    int total = 0, chunks = 0;
+    for (unsigned int i = 1; i < info->hdr->e_shnum; i++) {
+        if (info->sechdrs[i].sh_type == SHT_REL) return 1;
+        unsigned int num = rela_num(info, i);
+        total += num;
+        chunks += (num + RELA_CHUNK_NUM - 1) / RELA_CHUNK_NUM;
+    }
+    if (total < RELA_PARALLEL_MIN_NUM) return 1;
+
+    struct relo_work work = { .mod = mod, .info = info, .chunks = chunks };
+    atomic_set(&work.next, 0);
+    atomic_set(&work.rc, 0);
+    atomic_set(&work.running, 0);
+
+    int threads = 0;
+    for (int cpu = 0; cpu < RELA_MAX_CPUS; cpu++) {
+        if (!(online[0] & (1UL << cpu))) continue;
+        struct task_struct *thread =
+            kfunc(kthread_create_on_node)(relocate_thread, &work, NUMA_NO_NODE, "kpm_relo/%d", cpu);
+        if (IS_ERR_OR_NULL(thread)) continue;
+        kfunc(kthread_bind)(thread, cpu);
+        atomic_inc(&work.running);
+        kfunc(wake_up_process)(thread);
+        threads++;
+    }
+
+    relocate_chunks(&work);
+    while (atomic_read(&work.running)) kfunc(msleep)(1);
+
+    logkd("parallel relocation: %d, chunks: %d, threads: %d, rc: %d\n", total, chunks, threads, atomic_read(&work.rc));
+    return atomic_read(&work.rc);
+}
+
 static int apply_relocations(struct module *mod, const struct load_info *info)
 {
-    int rc = 0;
+    int rc = apply_relocations_parallel(mod, info);
+    if (rc <= 0) return rc;
+
+    rc = 0;
     unsigned int i;
     for (i = 1; i < info->hdr->e_shnum; i++) {
         unsigned int infosec = info->sechdrs[i].sh_info;
@@ -310,6 +491,11 @@ static int move_module(struct module *mod, struct load_info *info)
     if (info->info.author) mod->info.author = info->info.author - info->info.base + mod->info.base;
     if (info->info.description) mod->info.description = info->info.description - info->info.base + mod->info.base;
 
+    // symbol and string tables were made SHF_ALLOC by layout_symtab
+    mod->symtab = (Elf_Sym *)info->sechdrs[info->index.sym].sh_addr;
+    mod->num_symtab = info->sechdrs[info->index.sym].sh_size / sizeof(Elf_Sym);
+    mod->strtab = (const char *)info->sechdrs[info->index.str].sh_addr;
+
     return 0;
 }
 
@@ -395,14 +581,109 @@ static int elf_header_check(struct load_info *info)
 struct module modules = { 0 };
 static spinlock_t module_lock;
 
+#define MODULE_OWNER_NUM 16
+
+// Tasks running a module init or ctl, hooks added by such a task are owned by its module.
+static struct
+{
+    struct task_struct *task;
+    struct module *mod;
+} module_owners[MODULE_OWNER_NUM];
+static spinlock_t module_owner_lock;
+
+// Called under the hook lock, only the calling task writes or clears its own slot, so no lock here.
+static void *module_owner()
+{
+    struct task_struct *task = current;
+    for (int i = 0; i < MODULE_OWNER_NUM; i++) {
+        if (*(struct task_struct *volatile *)&module_owners[i].task == task) return module_owners[i].mod;
+    }
+    return 0;
+}
+
+static int module_owner_enter(struct module *mod)
+{
+    int slot = -1;
+    spin_lock(&module_owner_lock);
+    for (int i = 0; i < MODULE_OWNER_NUM; i++) {
+        if (!module_owners[i].task) {
+            module_owners[i].mod = mod;
+            module_owners[i].task = current;
+            slot = i;
+            break;
+        }
+    }
+    spin_unlock(&module_owner_lock);
+    if (slot < 0) logkfw("[%s] too many tasks in module init or ctl, hooks added now are not owned\n", mod->info.name);
+    return slot;
+}
+
+static void module_owner_exit(int slot)
+{
+    if (slot < 0) return;
+    spin_lock(&module_owner_lock);
+    module_owners[slot].task = 0;
+    module_owners[slot].mod = 0;
+    spin_unlock(&module_owner_lock);
+}
+
+// Hooks and user event handlers added by init or ctl and not removed by exit,
+// callbacks live in the module text that is freed next.
+// Return non-zero if some hooks are still reachable, the module text must be kept then.
+static int32_t release_module_hooks(struct module *mod)
+{
+    remove_user_event_handlers_in((uintptr_t)mod->start, (uintptr_t)mod->start + mod->size);
+    int32_t left = hook_release_owner(mod);
+    if (left) logkfe("[%s] %d hooks left, defer freeing module text\n", mod->info.name, left);
+    return left;
+}
+
+// Exited modules with hooks or readers left, the text is freed once a later release finds none.
+static struct list_head dying_modules;
+
+static void defer_module(struct module *mod)
+{
+    spin_lock(&module_lock);
+    list_add_tail(&mod->list, &dying_modules);
+    spin_unlock(&module_lock);
+}
+
+// Retry the release of dying modules, it sleeps, so the list is taken off under the lock.
+static void reclaim_dying_modules()
+{
+    LIST_HEAD(pending);
+    spin_lock(&module_lock);
+    list_splice_init(&dying_modules, &pending);
+    spin_unlock(&module_lock);
+
+    struct module *pos, *n;
+    list_for_each_entry_safe(pos, n, &pending, list)
+    {
+        if (hook_release_owner(pos)) continue;
+        list_del(&pos->list);
+        logkfi("[%s] free deferred module text\n", pos->info.name);
+        kp_free_exec(pos->start);
+        if (atomic_dec_and_test(&pos->refcnt)) {
+            kvfree(pos);
+        }
+    }
+
+    spin_lock(&module_lock);
+    list_splice(&pending, &dying_modules);
+    spin_unlock(&module_lock);
+}
+
 long load_module(const void *data, int len, const char *args, const char *event, void *__user reserved)
 {
     struct load_info load_info = { .len = len, .hdr = data };
     struct load_info *info = &load_info;
     long rc = 0;
 
+    reclaim_dying_modules();
+
     if ((rc = elf_header_check(info))) goto out;
     if ((rc = setup_load_info(info))) goto out;
+    if ((rc = check_undef_symbols(info))) goto out;
 
     if (find_module(info->info.name)) {
         logkfd("%s exist\n", info->info.name);
@@ -431,9 +712,11 @@ long load_module(const void *data, int len, const char *args, const char *event,
     if ((rc = simplify_symbols(mod, info))) goto free;
     if ((rc = apply_relocations(mod, info))) goto free;
 
-    flush_icache_all();
+    flush_module_icache();
 
+    int owner = module_owner_enter(mod);
     rc = (*mod->init)(mod->args, event, reserved);
+    module_owner_exit(owner);
 
     if (!rc) {
         logkfi("[%s] succeed with [%s] \n", mod->info.name, args);
@@ -442,11 +725,16 @@ long load_module(const void *data, int len, const char *args, const char *event,
     } else {
         logkfi("[%s] failed with [%s] error: %d, try exit ...\n", mod->info.name, args, rc);
         (*mod->exit)(reserved);
+        if (release_module_hooks(mod)) {
+            if (mod->args) kvfree(mod->args);
+            defer_module(mod);
+            goto out;
+        }
     }
 
 free:
     if (mod->args) kvfree(mod->args);
-    kp_free_exec(mod->start);
+    if (mod->start) kp_free_exec(mod->start);
 free1:
     kvfree(mod);
 out:
@@ -461,6 +749,8 @@ long unload_module(const char *name, void *__user reserved)
 
     long rc = 0;
 
+    reclaim_dying_modules();
+
     spin_lock(&module_lock);
     struct module *mod = find_module(name);
     if (!mod) {
@@ -472,15 +762,23 @@ long unload_module(const char *name, void *__user reserved)
     spin_unlock(&module_lock);
 
     rc = (*mod->exit)(reserved);
+    int32_t left = release_module_hooks(mod);
 
     if (mod->args) kvfree(mod->args);
     if (mod->ctl_args) kvfree(mod->ctl_args);
+    mod->args = mod->ctl_args = 0;
 
-    kp_free_exec(mod->start);
+    if (left) {
+        // drop the find reference, the loaded one goes once the text is freed
+        atomic_dec(&mod->refcnt);
+        defer_module(mod);
+    } else {
+        kp_free_exec(mod->start);
 
-    // 引用计数减一，只有为0时才释放
-    if (atomic_dec_and_test(&mod->refcnt)) {
-        kvfree(mod);
+        // 引用计数减一，只有为0时才释放
+        if (atomic_dec_and_test(&mod->refcnt)) {
+            kvfree(mod);
+        }
     }
 
     logkfi("name: %s, rc: %d\n", name, rc);
@@ -569,7 +867,9 @@ long module_control0(const char *name, const char *ctl_args, char *__user out_ms
 
     spin_unlock(&module_lock);
 
+    int owner = module_owner_enter(mod);
     rc = (*mod->ctl0)(mod->ctl_args, out_msg, outlen);
+    module_owner_exit(owner);
 
     logkfi("name: %s, rc: %d\n", name, rc);
 
@@ -604,7 +904,9 @@ long module_control1(const char *name, void *a1, void *a2, void *a3)
 
     spin_unlock(&module_lock);
 
+    int owner = module_owner_enter(mod);
     rc = (*mod->ctl1)(a1, a2, a3);
+    module_owner_exit(owner);
 
     logkfi("name: %s, rc: %d\n", name, rc);
 
@@ -690,8 +992,63 @@ int get_module_info(const char *name, char *out_info, int size)
     return sz;
 }
 
+/**
+ * @brief Copy the name of owner if it is a loaded module
+ * 
+ * @return int 0, or -ENOENT
+ */
+int module_name_of(void *owner, char *buf, int len)
+{
+    int rc = -ENOENT;
+    spin_lock(&module_lock);
+    struct module *pos;
+    list_for_each_entry(pos, &modules.list, list)
+    {
+        if (pos != owner) continue;
+        snprintf(buf, len, "%s", pos->info.name);
+        rc = 0;
+        break;
+    }
+    spin_unlock(&module_lock);
+    return rc;
+}
+
+/**
+ * @brief Resolve addr in a loaded module to the nearest function symbol below it, as symbol+0xoff
+ * 
+ * @return int 0, or -ENOENT
+ */
+int module_addr_symbol(unsigned long addr, char *sym, int sym_len)
+{
+    int rc = -ENOENT;
+    spin_lock(&module_lock);
+    struct module *pos;
+    list_for_each_entry(pos, &modules.list, list)
+    {
+        unsigned long start = (unsigned long)pos->start;
+        if (addr < start || addr >= start + pos->size) continue;
+        const Elf_Sym *best = 0;
+        for (unsigned int i = 1; i < pos->num_symtab; i++) {
+            const Elf_Sym *s = &pos->symtab[i];
+            if (ELF_ST_TYPE(s->st_info) != STT_FUNC || s->st_shndx == SHN_UNDEF) continue;
+            if (s->st_value > addr || (best && s->st_value <= best->st_value)) continue;
+            best = s;
+        }
+        if (best) {
+            snprintf(sym, sym_len, "%s+0x%lx", pos->strtab + best->st_name, addr - best->st_value);
+            rc = 0;
+        }
+        break;
+    }
+    spin_unlock(&module_lock);
+    return rc;
+}
+
 void module_init()
 {
     INIT_LIST_HEAD(&modules.list);
+    INIT_LIST_HEAD(&dying_modules);
     spin_lock_init(&module_lock);
+    spin_lock_init(&module_owner_lock);
+    hook_set_owner_fn(module_owner);
 }
\ No newline at end of file
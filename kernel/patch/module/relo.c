@@ -165,8 +165,9 @@ int apply_relocate(Elf64_Shdr *sechdrs, const char *strtab, unsigned int syminde
     return 0;
 };
 
-int apply_relocate_add(Elf64_Shdr *sechdrs, const char *strtab, unsigned int symindex, unsigned int relsec,
-                       struct module *me)
+// relocations in [start, end) of relsec, ranges of one section can be applied concurrently
+int apply_relocate_add_range(Elf64_Shdr *sechdrs, const char *strtab, unsigned int symindex, unsigned int relsec,
+                             unsigned int start, unsigned int end, struct module *me)
 {
     unsigned int i;
     int ovf;
@@ -176,7 +177,7 @@ int apply_relocate_add(Elf64_Shdr *sechdrs, const char *strtab, unsigned int sym
     u64 val;
     Elf64_Rela *rel = (void *)sechdrs[relsec].sh_addr;
 
-    for (i = 0; i < sechdrs[relsec].sh_size / sizeof(*rel); i++) {
+    for (i = start; i < end; i++) {
         /* loc corresponds to P in the AArch64 ELF document. */
         loc = (void *)sechdrs[sechdrs[relsec].sh_info].sh_addr + rel[i].r_offset;
         /* sym is the ELF symbol we're referring to. */
@@ -325,4 +326,11 @@ int apply_relocate_add(Elf64_Shdr *sechdrs, const char *strtab, unsigned int sym
 overflow:
     pr_err("overflow in relocation type %d val %llx\n", (int)ELF64_R_TYPE(rel[i].r_info), val);
     return -ENOEXEC;
+}
+
+int apply_relocate_add(Elf64_Shdr *sechdrs, const char *strtab, unsigned int symindex, unsigned int relsec,
+                       struct module *me)
+{
+    unsigned int num = sechdrs[relsec].sh_size / sizeof(Elf64_Rela);
+    return apply_relocate_add_range(sechdrs, strtab, symindex, relsec, 0, num, me);
 }
\ No newline at end of file
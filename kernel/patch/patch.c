@@ -11,6 +11,9 @@
 #include <module.h>
 #include <predata.h>
 #include <linux/string.h>
+#include <linux/delay.h>
+#include <linux/rcupdate.h>
+#include <asm/current.h>
 
 void print_bootlog()
 {
@@ -49,6 +52,7 @@ int resolve_pt_regs();
 int supercall_install();
 void module_init();
 void syscall_init();
+void user_event_init();
 int kstorage_init();
 int su_compat_init();
 
@@ -57,6 +61,22 @@ int android_user_init();
 int android_sepolicy_flags_fix();
 #endif
 
+static void hook_wait_relax()
+{
+    kfunc_call_void(msleep, 1);
+}
+
+// A preemptible kernel needs rcu tasks for tasks preempted outside the transit reader counters,
+// synchronize_rcu is enough without preemption.
+static void hook_wait_sync()
+{
+    if (kfunc(synchronize_rcu_tasks)) {
+        kfunc(synchronize_rcu_tasks)();
+    } else if (kfunc(synchronize_rcu)) {
+        kfunc(synchronize_rcu)();
+    }
+}
+
 static void before_rest_init(hook_fargs4_t *args, void *udata)
 {
     int rc = 0;
@@ -68,6 +88,8 @@ static void before_rest_init(hook_fargs4_t *args, void *udata)
     if ((rc = resolve_struct())) goto out;
     log_boot("resolve_struct done: %d\n", rc);
 
+    hook_set_stack(sp_el0_is_current ? stack_in_task_offset : -1, thread_size > 0 ? thread_size : THREAD_SIZE);
+
     if ((rc = bypass_selinux())) goto out;
     log_boot("bypass_selinux done: %d\n", rc);
 
@@ -124,6 +146,8 @@ int patch()
 {
     linux_libs_symbol_init();
     linux_misc_symbol_init();
+    hook_set_wait(hook_wait_relax, hook_wait_sync);
+    user_event_init();
     module_init();
     syscall_init();
 
@@ -40,15 +40,27 @@ int su_nums(const char *key)
 
 int su_list(const char *key)
 {
-    uid_t uids[256];
-    int rc = sc_su_allow_uids(key, uids, sizeof(uids) / sizeof(uids[0]));
-    if (rc > 0) {
-        for (int i = 0; i < rc; i++) {
-            fprintf(stdout, "%d\n", uids[i]);
+    uid_t *uids = 0;
+    long rc = sc_su_allow_list(key, 0, 0, 0);
+    // grow until the whole list fits
+    while (rc > 0) {
+        int num = rc;
+        uid_t *nuids = realloc(uids, num * sizeof(uid_t));
+        if (!nuids) {
+            rc = -ENOMEM;
+            break;
+        }
+        uids = nuids;
+        rc = sc_su_allow_list(key, uids, num, 0);
+        if (rc <= num) {
+            for (int i = 0; i < rc; i++) {
+                fprintf(stdout, "%d\n", uids[i]);
+            }
+            break;
         }
-        return 0;
     }
-    return rc;
+    free(uids);
+    return rc < 0 ? rc : 0;
 }
 
 int su_profile(const char *key, uid_t uid)
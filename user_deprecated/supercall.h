@@ -193,6 +193,23 @@ static inline long sc_su_allow_uids(const char *key, uid_t *buf, int num)
     return ret;
 }
 
+/**
+ * @brief List su allowed uids or profiles in one call
+ * 
+ * @param key : superkey or 'su' string if caller uid is su allowed 
+ * @param buf : uid_t array, or struct su_profile array if SU_LIST_FLAG_PROFILE is set
+ * @param num : number of elements buf can hold, 0 to only get the total
+ * @param flags : SU_LIST_FLAG_*
+ * @return long : The total numbers of allowed uids, may be greater than num, nagative value if failed
+ */
+static inline long sc_su_allow_list(const char *key, void *buf, int num, int flags)
+{
+    if (!key || !key[0]) return -EINVAL;
+    if (num < 0 || (num && !buf)) return -EINVAL;
+    long ret = syscall(__NR_supercall, key, compact_cmd(key, SUPERCALL_SU_LIST_EX), buf, num, flags);
+    return ret;
+}
+
 /**
  * @brief Get su profile of specified uid
  * 